@@ -10,11 +10,41 @@ INCLUDEPATH += ../blib/
 INCLUDEPATH += ./assimp/
 INCLUDEPATH += ../blib/externals
 
-#HEADERS += ModelConvert.h
+HEADERS += ModelConvert.h
+HEADERS += ThreadPool.h
+HEADERS += Cache.h
+HEADERS += SceneImport.h
+HEADERS += BoundedQueue.h
+HEADERS += Progress.h
+HEADERS += Trace.h
+HEADERS += MemoryStats.h
+HEADERS += Logger.h
+HEADERS += MappedFile.h
 
 SOURCES += main.cpp
 SOURCES += assimp.cpp
+SOURCES += AssimpAnim.cpp
 SOURCES += pmd.cpp
+SOURCES += KeyReduction.cpp
+SOURCES += BinaryAnim.cpp
+SOURCES += ThreadPool.cpp
+SOURCES += Cache.cpp
+SOURCES += SceneImport.cpp
+SOURCES += ImportProfiles.cpp
+SOURCES += NativeSteps.cpp
+SOURCES += Batch.cpp
+SOURCES += Scheduler.cpp
+SOURCES += ForkServer.cpp
+SOURCES += Progress.cpp
+SOURCES += Daemon.cpp
+SOURCES += Watch.cpp
+SOURCES += Trace.cpp
+SOURCES += MemoryStats.cpp
+SOURCES += Benchmark.cpp
+SOURCES += Stats.cpp
+SOURCES += Logger.cpp
+SOURCES += ObjReader.cpp
+SOURCES += pmx.cpp
 
 LIBS += -L../blib -lblib
 LIBS += -lGL
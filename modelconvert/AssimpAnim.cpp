@@ -1,15 +1,25 @@
 #include <string>
+#include <atomic>
 #include <functional>
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <glm/glm.hpp>
 
 #include <blib/json.h>
 #include <blib/util/FileSystem.h>
-#include <blib/util/Log.h>
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
-using blib::util::Log;
+#include "ModelConvert.h"
+#include "ThreadPool.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "SceneImport.h"
+#include "Logger.h"
 
 blib::json::Value materialToJson(const aiMaterial* material);
 blib::json::Value matrixAsJson(const aiMatrix4x4& matrix);
@@ -20,6 +30,7 @@ static int vertexSize = 0;
 
 void import(blib::json::Value &data, const aiScene* scene, aiNode* node)
 {
+	TRACE_SCOPE("import node");
 	for (unsigned int i = 0; i < node->mNumMeshes; i++)
 	{
 		const struct aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
@@ -27,7 +38,7 @@ void import(blib::json::Value &data, const aiScene* scene, aiNode* node)
 		std::vector<glm::vec3> vertexNormals;
 		if (!mesh->HasNormals())
 		{
-			Log::out << "Mesh does not have normals...calculating" << Log::newline;
+			LOG(Warning) << "Mesh does not have normals...calculating";
 
 			for (unsigned int ii = 0; ii < mesh->mNumFaces; ii++)
 			{
@@ -160,35 +171,318 @@ void import(blib::json::Value &data, const aiScene* scene, aiNode* node)
 }
 
 
-blib::json::Value buildSkeleton(const aiNode* node)
+//nodes are indexed depth-first, in the order they appear in the .skel.json file
+blib::json::Value buildSkeleton(const aiNode* node, std::map<std::string, int> &nodeIndices, int &index)
 {
 	blib::json::Value skeleton;
 	skeleton["name"] = node->mName.C_Str();
+	skeleton["index"] = index++;
+	if (nodeIndices.find(node->mName.C_Str()) == nodeIndices.end())
+		nodeIndices[node->mName.C_Str()] = skeleton["index"].asInt();
+	else
+		LOG(Warning) << "duplicate node name " << node->mName.C_Str() << ", animations will bind to the first one";
 	skeleton["matrix"] = matrixAsJson(node->mTransformation);
 	for (unsigned int i = 0; i < node->mNumChildren; i++)
-		skeleton["children"].push_back(buildSkeleton(node->mChildren[i]));
+		skeleton["children"].push_back(buildSkeleton(node->mChildren[i], nodeIndices, index));
 	return skeleton;
 }
 
 
-blib::json::Value convertAssimpAnim(const std::string &filename)
+template<class T>
+static bool keyBefore(double time, const T& key)
 {
-	blib::json::Value modelData;
-	blib::json::Value skeletonData;
+	return time < key.mTime;
+}
+
+//linear interpolation between the two keys around time, clamped to the first and last key
+aiVector3D sampleKeys(const aiVectorKey* keys, unsigned int count, double time)
+{
+	const aiVectorKey* next = std::upper_bound(keys, keys + count, time, keyBefore<aiVectorKey>);
+	if (next == keys)
+		return keys[0].mValue;
+	if (next == keys + count)
+		return keys[count - 1].mValue;
+	const aiVectorKey* prev = next - 1;
+	float fac = (float)((time - prev->mTime) / (next->mTime - prev->mTime));
+	return prev->mValue + (next->mValue - prev->mValue) * fac;
+}
+
+aiQuaternion sampleKeys(const aiQuatKey* keys, unsigned int count, double time)
+{
+	const aiQuatKey* next = std::upper_bound(keys, keys + count, time, keyBefore<aiQuatKey>);
+	if (next == keys)
+		return keys[0].mValue;
+	if (next == keys + count)
+		return keys[count - 1].mValue;
+	const aiQuatKey* prev = next - 1;
+	aiQuaternion ret;
+	aiQuaternion::Interpolate(ret, prev->mValue, next->mValue, (float)((time - prev->mTime) / (next->mTime - prev->mTime)));
+	return ret.Normalize();
+}
+
+//samples every channel at a fixed rate. The tracks are stored frame by frame, with the values for all channels (in stream order) next to eachother
+static blib::json::Value resampleAnimation(const aiScene* scene, const aiAnimation* animation, float rate)
+{
+	blib::json::Value tracks;
+	double tps = animation->mTicksPerSecond != 0 ? animation->mTicksPerSecond : 25;
+	int frameCount = (int)floor(animation->mDuration / tps * rate) + 1;
+
+	tracks["rate"] = rate;
+	tracks["frames"] = frameCount;
+	tracks["positions"] = blib::json::Value(blib::json::Type::arrayValue);
+	tracks["rotations"] = blib::json::Value(blib::json::Type::arrayValue);
+	tracks["scales"] = blib::json::Value(blib::json::Type::arrayValue);
+
+	//channels without keys of some kind keep the value from the node's own transformation
+	std::vector<aiVector3D> restPositions(animation->mNumChannels);
+	std::vector<aiQuaternion> restRotations(animation->mNumChannels);
+	std::vector<aiVector3D> restScales(animation->mNumChannels, aiVector3D(1, 1, 1));
+	std::vector<aiQuaternion> lastRotations(animation->mNumChannels);
+	for (unsigned int i = 0; i < animation->mNumChannels; i++)
+	{
+		const aiNode* node = scene->mRootNode->FindNode(animation->mChannels[i]->mNodeName);
+		if (node)
+			node->mTransformation.Decompose(restScales[i], restRotations[i], restPositions[i]);
+	}
 
-	Assimp::Importer importer;
-	char* data;
-	int len = blib::util::FileSystem::getData(filename, data);
-	if (len == 0)
+	for (int frame = 0; frame < frameCount; frame++)
 	{
-		printf("Error opening file %s\n", filename.c_str());
-		return blib::json::Value::null;
+		double time = std::min(frame / rate * tps, animation->mDuration);
+		for (unsigned int i = 0; i < animation->mNumChannels; i++)
+		{
+			const aiNodeAnim* stream = animation->mChannels[i];
+			aiVector3D pos = stream->mNumPositionKeys > 0 ? sampleKeys(stream->mPositionKeys, stream->mNumPositionKeys, time) : restPositions[i];
+			aiQuaternion rot = stream->mNumRotationKeys > 0 ? sampleKeys(stream->mRotationKeys, stream->mNumRotationKeys, time) : restRotations[i];
+			aiVector3D scale = stream->mNumScalingKeys > 0 ? sampleKeys(stream->mScalingKeys, stream->mNumScalingKeys, time) : restScales[i];
+
+			//keep rotations in the same hemisphere as the previous frame, so the runtime can just lerp between frames
+			if (frame > 0 && lastRotations[i].x * rot.x + lastRotations[i].y * rot.y + lastRotations[i].z * rot.z + lastRotations[i].w * rot.w < 0)
+				rot = aiQuaternion(-rot.w, -rot.x, -rot.y, -rot.z);
+			lastRotations[i] = rot;
+
+			tracks["positions"].push_back(pos.x);
+			tracks["positions"].push_back(pos.y);
+			tracks["positions"].push_back(pos.z);
+			tracks["rotations"].push_back(rot.x);
+			tracks["rotations"].push_back(rot.y);
+			tracks["rotations"].push_back(rot.z);
+			tracks["rotations"].push_back(rot.w);
+			tracks["scales"].push_back(scale.x);
+			tracks["scales"].push_back(scale.y);
+			tracks["scales"].push_back(scale.z);
+		}
+	}
+	return tracks;
+}
+
+//replaces the keys of every channel with keys at a fixed rate, for binary clips that store key times as frame numbers.
+//Kinds of keys a channel does not have are left out, like in the original
+template<class Key>
+static void resampleTrack(Key* &keys, unsigned int &count, int frameCount, double ticksPerFrame, double duration)
+{
+	if (count == 0)
+		return;
+	Key* resampled = new Key[frameCount];
+	for (int frame = 0; frame < frameCount; frame++)
+	{
+		resampled[frame].mTime = std::min(frame * ticksPerFrame, duration);
+		resampled[frame].mValue = sampleKeys(keys, count, resampled[frame].mTime);
+	}
+	delete[] keys;
+	keys = resampled;
+	count = frameCount;
+}
+
+static void resampleKeys(aiAnimation* animation, float rate)
+{
+	double tps = animation->mTicksPerSecond != 0 ? animation->mTicksPerSecond : 25;
+	int frameCount = (int)floor(animation->mDuration / tps * rate) + 1;
+	for (unsigned int i = 0; i < animation->mNumChannels; i++)
+	{
+		aiNodeAnim* stream = animation->mChannels[i];
+		resampleTrack(stream->mPositionKeys, stream->mNumPositionKeys, frameCount, tps / rate, animation->mDuration);
+		resampleTrack(stream->mRotationKeys, stream->mNumRotationKeys, frameCount, tps / rate, animation->mDuration);
+		resampleTrack(stream->mScalingKeys, stream->mNumScalingKeys, frameCount, tps / rate, animation->mDuration);
+	}
+}
+
+//writes a single clip to outfile.anim.json or outfile.anim. Clips are exported in parallel, so this should only touch its own animation
+static bool exportAnimation(const std::string &outfile, const aiScene* scene, aiAnimation* animation, const std::vector<int> &bindings, const Options &options)
+{
+	TRACE_SCOPE("export animation");
+	//binary clips have no per-frame tracks, their keys are resampled instead, before the reduction so it can thin them out again
+	if (options.binaryAnimations && options.resampleRate > 0)
+	{
+		TRACE_SCOPE("resample keys");
+		resampleKeys(animation, options.resampleRate);
+	}
+	if (options.reducePosition > 0 || options.reduceRotation > 0 || options.reduceScale > 0)
+	{
+		TRACE_SCOPE("reduce keys");
+		reduceAnimation(scene, animation, options);
+	}
+
+	if (options.binaryAnimations)
+		return writeBinaryAnimation(outfile + ".anim" + options.outputSuffix, animation, bindings, options);
+
+	float tps = (float)animation->mTicksPerSecond;
+	if (tps == 0)
+		tps = 25;
+
+	blib::json::Value animationData;
+	animationData["name"] = animation->mName.C_Str();
+	animationData["length"] = (float)(animation->mDuration / tps);
+	animationData["bindings"] = blib::json::Value(blib::json::Type::arrayValue);
+	for (size_t ii = 0; ii < bindings.size(); ii++)
+		animationData["bindings"].push_back(bindings[ii]);
+
+	for (unsigned int ii = 0; ii < animation->mNumChannels; ii++)
+	{
+		const aiNodeAnim* stream = animation->mChannels[ii];
+		blib::json::Value streamData;
+		streamData["node"] = stream->mNodeName.C_Str();
+		if (options.resampleRate > 0)
+		{
+			animationData["streams"].push_back(streamData);
+			continue;
+		}
+		for (size_t iii = 0; iii < stream->mNumPositionKeys; iii++)
+		{
+			blib::json::Value data;
+			data["time"] = (float)(stream->mPositionKeys[iii].mTime / tps);
+			data["pos"].push_back(stream->mPositionKeys[iii].mValue.x);
+			data["pos"].push_back(stream->mPositionKeys[iii].mValue.y);
+			data["pos"].push_back(stream->mPositionKeys[iii].mValue.z);
+			streamData["positions"].push_back(data);
+		}
+		for (size_t iii = 0; iii < stream->mNumScalingKeys; iii++)
+		{
+			blib::json::Value data;
+			data["time"] = (float)(stream->mScalingKeys[iii].mTime / tps);
+			data["scale"].push_back(stream->mScalingKeys[iii].mValue.x);
+			data["scale"].push_back(stream->mScalingKeys[iii].mValue.y);
+			data["scale"].push_back(stream->mScalingKeys[iii].mValue.z);
+			streamData["scales"].push_back(data);
+		}
+		for (size_t iii = 0; iii < stream->mNumRotationKeys; iii++)
+		{
+			blib::json::Value data;
+			data["time"] = (float)(stream->mRotationKeys[iii].mTime / tps);
+			data["rot"].push_back(stream->mRotationKeys[iii].mValue.x);
+			data["rot"].push_back(stream->mRotationKeys[iii].mValue.y);
+			data["rot"].push_back(stream->mRotationKeys[iii].mValue.z);
+			data["rot"].push_back(stream->mRotationKeys[iii].mValue.w);
+			streamData["rotations"].push_back(data);
+		}
+
+
+		animationData["streams"].push_back(streamData);
 	}
+	if (options.resampleRate > 0)
+		animationData["tracks"] = resampleAnimation(scene, animation, options.resampleRate);
+
+
 
-	const aiScene* scene = importer.ReadFileFromMemory(data, len, aiProcessPreset_TargetRealtime_Quality | aiProcess_OptimizeMeshes | aiProcess_RemoveRedundantMaterials | aiProcess_OptimizeGraph);
+	blib::json::Value printConfig = blib::json::readJson(R"V0G0N(	
+	{
+		"wrap" : 1,
+		"bindings" :
+		{
+			"wrap" : 16
+		},
+		"streams" :
+		{	
+			"wrap" : 1,
+			"elements" :
+			{		
+				"wrap" : 1,
+				"positions" :
+				{	
+					"wrap" : 1,
+					"elements" :
+					{
+						"wrap" : 1,
+						"pos" : { "wrap" : 3 }
+					}
+				},
+				"scales" :
+				{	
+					"wrap" : 1,
+					"elements" :
+					{
+						"wrap" : 1,
+						"scale" : { "wrap" : 3 }
+					}
+				},
+				"rotations" :
+				{	
+					"wrap" : 1,
+					"elements" :
+					{
+						"wrap" : 1,
+						"rot" : { "wrap" : 4 }
+					}
+				}
+			}
+		},
+		"tracks" :
+		{
+			"wrap" : 1,
+			"positions" : { },
+			"rotations" : { },
+			"scales" : { }
+		}
+	})V0G0N");
+	//one frame per line
+	printConfig["tracks"]["positions"]["wrap"] = 3 * (int)animation->mNumChannels;
+	printConfig["tracks"]["rotations"]["wrap"] = 4 * (int)animation->mNumChannels;
+	printConfig["tracks"]["scales"]["wrap"] = 3 * (int)animation->mNumChannels;
+
+	TRACE_SCOPE("write animation");
+	std::ofstream out(outfile + ".anim.json" + options.outputSuffix);
+	animationData.prettyPrint(out, printConfig);
+	out.close();
+	return true;
+}
+
+
+//also used for the pmd skeletons, which have the ik chains of the bones as well
+void writeSkeleton(const blib::json::Value &skeleton, const std::string &outfile)
+{
+	TRACE_SCOPE("write skeleton");
+	std::ofstream out(outfile);
+	skeleton.prettyPrint(out, blib::json::readJson(R"V0G0N(	
+{
+	"recursive" : true,
+	"wrap" : 1,
+	"matrix" :
+	{
+		"wrap" : 4,
+		"seperator" : "		",
+		"elements" : { "wrap" : 4 }
+	},
+	"offset" :
+	{
+		"wrap" : 4,
+		"seperator" : "		",
+		"elements" : { "wrap" : 4 }
+	},
+	"sort" : [ "name", "index", "matrix", "offset", "id", "ik", "children" ]
+})V0G0N"));
+	out.close();
+}
+
+
+blib::json::Value convertAssimpAnim(const std::string &filename, const Options &options, std::vector<std::string> &outputFiles)
+{
+	blib::json::Value modelData;
+	blib::json::Value skeletonData;
+
+	SceneImport sceneImport(filename, options);
+	const aiScene* scene = sceneImport.scene;
 	if (!scene)
 	{
-		printf("Errors? : %s\n", importer.GetErrorString());
+		LOG(Error) << "Could not import " << filename << ": " << sceneImport.error;
 		return blib::json::Value::null;
 	}
 
@@ -218,10 +512,17 @@ blib::json::Value convertAssimpAnim(const std::string &filename)
 			if (modelData["vertices"][i + 8 + ii].asInt() == -1)
 				modelData["vertices"][i + 8 + ii] = 0;
 	}
+	if (!progress.update("meshes", 1))
+		return blib::json::Value::null;
 
 
+	ThreadPool pool(options.threads);
+	//the mesh, skeleton and every clip are written on the pool while the rest is still being built
+	outputFiles.push_back(filename + ".mesh.json");
+	pool.addJob([&filename, &modelData, &options]()
 	{
-		std::ofstream out(filename + ".mesh.json");
+		TRACE_SCOPE("write mesh");
+		std::ofstream out(filename + ".mesh.json" + options.outputSuffix);
 		modelData.prettyPrint(out, blib::json::readJson(R"V0G0N(	
 	{
 		"wrap" : 1,
@@ -252,10 +553,12 @@ blib::json::Value convertAssimpAnim(const std::string &filename)
 		"sort" : [ "name", "version", "format", "vertices", "meshes" ]
 	})V0G0N"));
 		out.close();
-	}
+	});
 
 	//build up json tree
-	skeletonData = buildSkeleton(scene->mRootNode);
+	std::map<std::string, int> nodeIndices;
+	int nodeCount = 0;
+	skeletonData = buildSkeleton(scene->mRootNode, nodeIndices, nodeCount);
 	//fill in the nodes
 	for (unsigned int i = 0; i < scene->mNumMeshes; i++)
 	{
@@ -285,123 +588,62 @@ blib::json::Value convertAssimpAnim(const std::string &filename)
 	}
 
 
+	outputFiles.push_back(filename + ".skel.json");
+	pool.addJob([&filename, &skeletonData, &options]()
 	{
-		std::ofstream out(filename + ".skel.json");
-		skeletonData.prettyPrint(out, blib::json::readJson(R"V0G0N(	
-	{
-		"recursive" : true,
-		"wrap" : 1,
-		"matrix" :
-		{
-			"wrap" : 4,
-			"seperator" : "		",
-			"elements" : { "wrap" : 4 }
-		},
-		"offset" :
-		{
-			"wrap" : 4,
-			"seperator" : "		",
-			"elements" : { "wrap" : 4 }
-		},
-		"sort" : [ "name", "matrix", "offset", "id", "children" ]
-	})V0G0N"));
-		out.close();
-	}
+		writeSkeleton(skeletonData, filename + ".skel.json" + options.outputSuffix);
+	});
 
 
-	for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+	std::map<std::string, int> clipNames;
+	std::atomic<int> exported(0);
+	std::atomic<bool> failed(false);
+	for (unsigned int i = 0; i < scene->mNumAnimations && !progress.isCancelled(); i++)
 	{
-		blib::json::Value animationData;
-		const aiAnimation* animation = scene->mAnimations[i];
-		float tps = (float)animation->mTicksPerSecond;
-		if (tps == 0)
-			tps = 25;
-
-		animationData["name"] = animation->mName.C_Str();
-		animationData["length"] = (float)(animation->mDuration / tps);
-		
+		aiAnimation* animation = scene->mAnimations[i];
+
+		//bindings[i] is the skeleton index that channel i animates, so the runtime does not have to match names
+		std::vector<int> bindings;
+		int unbound = 0;
 		for (unsigned int ii = 0; ii < animation->mNumChannels; ii++)
 		{
-			const aiNodeAnim* stream = animation->mChannels[ii];
-			blib::json::Value streamData;
-			streamData["node"] = stream->mNodeName.C_Str();
-			for (size_t iii = 0; iii < stream->mNumPositionKeys; iii++)
-			{
-				blib::json::Value data;
-				data["time"] = (float)(stream->mPositionKeys[iii].mTime / tps);
-				data["pos"].push_back(stream->mPositionKeys[iii].mValue.x);
-				data["pos"].push_back(stream->mPositionKeys[iii].mValue.y);
-				data["pos"].push_back(stream->mPositionKeys[iii].mValue.z);
-				streamData["positions"].push_back(data);
-			}
-			for (size_t iii = 0; iii < stream->mNumScalingKeys; iii++)
-			{
-				blib::json::Value data;
-				data["time"] = (float)(stream->mScalingKeys[iii].mTime / tps);
-				data["scale"].push_back(stream->mScalingKeys[iii].mValue.x);
-				data["scale"].push_back(stream->mScalingKeys[iii].mValue.y);
-				data["scale"].push_back(stream->mScalingKeys[iii].mValue.z);
-				streamData["scales"].push_back(data);
-			}
-			for (size_t iii = 0; iii < stream->mNumRotationKeys; iii++)
+			std::map<std::string, int>::const_iterator it = nodeIndices.find(animation->mChannels[ii]->mNodeName.C_Str());
+			if (it != nodeIndices.end())
+				bindings.push_back(it->second);
+			else
 			{
-				blib::json::Value data;
-				data["time"] = (float)(stream->mRotationKeys[iii].mTime / tps);
-				data["rot"].push_back(stream->mRotationKeys[iii].mValue.x);
-				data["rot"].push_back(stream->mRotationKeys[iii].mValue.y);
-				data["rot"].push_back(stream->mRotationKeys[iii].mValue.z);
-				data["rot"].push_back(stream->mRotationKeys[iii].mValue.w);
-				streamData["rotations"].push_back(data);
+				LOG(Warning) << "animation " << animation->mName.C_Str() << " has a channel for node " << animation->mChannels[ii]->mNodeName.C_Str() << ", which is not in the skeleton";
+				bindings.push_back(-1);
+				unbound++;
 			}
-
-
-			animationData["streams"].push_back(streamData);
 		}
+		if (unbound > 0)
+			LOG(Info) << "Animation " << animation->mName.C_Str() << ": " << unbound << " of " << (int)animation->mNumChannels << " channels do not target a bone";
 
-
-
-		std::ofstream out(filename + "."+animationData["name"].asString()+".anim.json");
-		animationData.prettyPrint(out, blib::json::readJson(R"V0G0N(	
-	{
-		"wrap" : 1,
-		"streams" :
-		{	
-			"wrap" : 1,
-			"elements" :
-			{		
-				"wrap" : 1,
-				"positions" :
-				{	
-					"wrap" : 1,
-					"elements" :
-					{
-						"wrap" : 1,
-						"pos" : { "wrap" : 3 }
-					}
-				},
-				"scales" :
-				{	
-					"wrap" : 1,
-					"elements" :
-					{
-						"wrap" : 1,
-						"scale" : { "wrap" : 3 }
-					}
-				},
-				"rotations" :
-				{	
-					"wrap" : 1,
-					"elements" :
-					{
-						"wrap" : 1,
-						"rot" : { "wrap" : 4 }
-					}
-				}
-			}
+		//clips with the same name would write to the same file, and which one ends up there would depend on the thread timing
+		std::string name = animation->mName.C_Str();
+		if (clipNames[name]++ > 0)
+		{
+			LOG(Warning) << "there are multiple animations called " << name << ", writing this one as " << name << "_" << (int)i;
+			name += "_" + std::to_string(i);
 		}
-	})V0G0N"));
-		out.close();
 
+		std::string outfile = filename + "." + name;
+		outputFiles.push_back(outfile + (options.binaryAnimations ? ".anim" : ".anim.json"));
+		pool.addJob([outfile, scene, animation, bindings, &options, &exported, &failed]()
+		{
+			if (progress.isCancelled())
+				return;
+			if (!exportAnimation(outfile, scene, animation, bindings, options))
+				failed = true;
+			progress.update("animations", ++exported / (float)scene->mNumAnimations);
+		});
+	}
+	pool.waitForJobs();
+	if (progress.isCancelled() || failed)
+	{
+		removeOutputFiles(outputFiles, options);
+		return blib::json::Value::null;
 	}
 
 
@@ -0,0 +1,118 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <stdio.h>
+
+#include <blib/json.h>
+
+#include "ModelConvert.h"
+#include "Cache.h"
+#include "BoundedQueue.h"
+#include "Trace.h"
+#include "Logger.h"
+
+// Batch conversion runs in three stages, so reading from slow storage and writing the results overlap with converting:
+//   a reader thread reads the next models and their side files ahead of the converter, so the converter finds them in
+//   the system's file cache. It stays at most options.prefetch files ahead
+//   the calling thread converts the models
+//   a writer thread writes the converted models and stores them in the conversion cache
+
+struct ConvertedModel
+{
+	std::string filename;
+	std::string outfile;
+	std::string cacheKey;
+	blib::json::Value data;
+	std::vector<std::string> outputFiles;
+};
+
+static void readAhead(const std::string &filename)
+{
+	TRACE_SCOPE("read ahead");
+	std::ifstream file(filename.c_str(), std::ios_base::binary | std::ios_base::in);
+	char buf[65536];
+	while (file)
+		file.read(buf, sizeof(buf));
+}
+
+
+int convertBatch(const std::vector<std::string> &files, const Options &options)
+{
+	ConversionCache* cache = NULL;
+	std::mutex cacheMutex;
+	if (!options.cacheDirectory.empty())
+		cache = new ConversionCache(options.cacheDirectory, options.cacheSize * 1024LL * 1024LL, options.cacheLinks);
+
+	BoundedQueue<std::string> readQueue(options.prefetch);
+	BoundedQueue<ConvertedModel*> writeQueue(options.prefetch);
+
+	std::thread reader([&files, &readQueue]()
+	{
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			readAhead(files[i]);
+			std::vector<std::string> side = sideFiles(files[i]);
+			for (size_t ii = 0; ii < side.size(); ii++)
+				readAhead(side[ii]);
+			readQueue.push(files[i]);
+		}
+		readQueue.close();
+	});
+
+	int failed = 0;
+	std::thread writer([&writeQueue, &cache, &cacheMutex, &failed]()
+	{
+		ConvertedModel* model;
+		while (writeQueue.pop(model))
+		{
+			if (!model->data.isNull())
+			{
+				writeModel(model->data, model->outfile);
+				model->outputFiles.push_back(model->outfile);
+				LOG(Info) << "Wrote " << model->outfile;
+			}
+			else if (model->outputFiles.empty()) // animated models are written by the converter, which returns null
+			{
+				LOG(Error) << "Could not convert " << model->filename;
+				failed++;
+			}
+			if (cache && !model->outputFiles.empty())
+			{
+				std::lock_guard<std::mutex> lock(cacheMutex);
+				cache->store(model->cacheKey, model->filename, model->outfile, model->outputFiles);
+			}
+			delete model;
+		}
+	});
+
+	std::string filename;
+	while (readQueue.pop(filename))
+	{
+		LOG(Info) << "Converting " << filename;
+		ConvertedModel* model = new ConvertedModel();
+		model->filename = filename;
+		model->outfile = filename + ".json";
+		if (cache)
+		{
+			model->cacheKey = cache->key(filename, options);
+			std::lock_guard<std::mutex> lock(cacheMutex);
+			if (cache->restore(model->cacheKey, filename, model->outfile))
+			{
+				delete model;
+				continue;
+			}
+		}
+		model->data = convertModel(filename, options, model->outputFiles);
+		writeQueue.push(model);
+	}
+	writeQueue.close();
+
+	reader.join();
+	writer.join();
+	delete cache;
+
+	printf("Converted %i of %i models\n", (int)files.size() - failed, (int)files.size());
+	return failed > 0 ? -1 : 0;
+}
@@ -0,0 +1,579 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <blib/json.h>
+
+#include "ModelConvert.h"
+#include "Trace.h"
+
+// The benchmark writes models of a few sizes to a directory and times every conversion path on them: pmd grids for
+// convertPmd, obj grids and collada spheres for convertAssimp, the obj grids again with the native obj reader, and
+// skinned collada rigs with a number of bones and clips for convertAssimpAnim. Every conversion runs a few times, and
+// the median run is reported with its throughput and the stages that took the most time, from the trace scopes. The
+// medians can be kept as a baseline, and later runs checked against it, so a converter build that got slower fails
+// before it is deployed
+
+static const int sizes[] = { 32, 128, 512 };	// quads along a side
+static const int rigBones = 32;
+static const int rigClips = 4;
+static const int rigKeys = 30;
+
+
+static void writeFloats(std::ostream &out, const std::vector<float> &values)
+{
+	char buf[32];
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		snprintf(buf, sizeof(buf), i + 1 < values.size() ? "%g " : "%g", values[i]);
+		out << buf;
+	}
+}
+
+static void writeInts(std::ostream &out, const std::vector<int> &values)
+{
+	for (size_t i = 0; i < values.size(); i++)
+		out << values[i] << (i + 1 < values.size() ? " " : "");
+}
+
+//a grid in the plane of axes a and b, (side+1)^2 vertices
+static void grid(int side, float size, int a, int b, std::vector<float> &positions, std::vector<float> &normals, std::vector<float> &uvs, std::vector<int> &indices)
+{
+	for (int y = 0; y <= side; y++)
+	{
+		for (int x = 0; x <= side; x++)
+		{
+			float position[3] = { 0, 0, 0 };
+			float normal[3] = { 0, 0, 0 };
+			position[a] = x * size / side;
+			position[b] = y * size / side;
+			normal[3 - a - b] = 1;
+			positions.insert(positions.end(), position, position + 3);
+			normals.insert(normals.end(), normal, normal + 3);
+			uvs.push_back(x / (float)side);
+			uvs.push_back(y / (float)side);
+		}
+	}
+	for (int y = 0; y < side; y++)
+	{
+		for (int x = 0; x < side; x++)
+		{
+			int i = y * (side + 1) + x;
+			int quad[6] = { i, i + side + 1, i + 1, i + 1, i + side + 1, i + side + 2 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+}
+
+static long long writeGridObj(const std::string &filename, int side)
+{
+	std::vector<float> positions, normals, uvs;
+	std::vector<int> indices;
+	grid(side, 10, 0, 2, positions, normals, uvs, indices);
+
+	std::string mtl = filename.substr(0, filename.rfind(".")) + ".mtl";
+	std::ofstream(mtl.c_str()) << "newmtl grid\nKd 0.8 0.8 0.8\nmap_Kd grid.png\n";
+	std::ofstream out(filename.c_str());
+	out << "mtllib " << mtl.substr(mtl.find_last_of("/\\") + 1) << "\nusemtl grid\n";
+	char buf[128];
+	for (size_t i = 0; i < positions.size() / 3; i++)
+	{
+		snprintf(buf, sizeof(buf), "v %g %g %g\nvt %g %g\nvn %g %g %g\n", positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2],
+			uvs[i * 2], uvs[i * 2 + 1], normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]);
+		out << buf;
+	}
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		snprintf(buf, sizeof(buf), "f %i/%i/%i %i/%i/%i %i/%i/%i\n", indices[i] + 1, indices[i] + 1, indices[i] + 1,
+			indices[i + 1] + 1, indices[i + 1] + 1, indices[i + 1] + 1, indices[i + 2] + 1, indices[i + 2] + 1, indices[i + 2] + 1);
+		out << buf;
+	}
+	return positions.size() / 3;
+}
+
+//pmd indices are 16 bit, so the grid is kept under 65536 vertices
+static long long writeGridPmd(const std::string &filename, int side)
+{
+	side = std::min(side, 255);
+	std::vector<float> positions, normals, uvs;
+	std::vector<int> indices;
+	grid(side, 10, 0, 1, positions, normals, uvs, indices);
+
+	std::ofstream out(filename.c_str(), std::ios_base::binary | std::ios_base::out);
+	char header[3 + 4 + 20 + 256] = { 'P', 'm', 'd' };
+	float version = 1;
+	memcpy(header + 3, &version, 4);
+	out.write(header, sizeof(header));
+
+	uint32_t vertexCount = (uint32_t)(positions.size() / 3);
+	out.write((const char*)&vertexCount, 4);
+	for (uint32_t i = 0; i < vertexCount; i++)
+	{
+		out.write((const char*)&positions[i * 3], 12);
+		out.write((const char*)&normals[i * 3], 12);
+		out.write((const char*)&uvs[i * 2], 8);
+		char bones[6] = { 0, 0, 0, 0, 100, 0 }; // two bone ids, the weight of the first and the edge flag
+		out.write(bones, sizeof(bones));
+	}
+
+	uint32_t indexCount = (uint32_t)indices.size();
+	out.write((const char*)&indexCount, 4);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		uint16_t index = (uint16_t)indices[i];
+		out.write((const char*)&index, 2);
+	}
+
+	uint32_t materialCount = 1;
+	out.write((const char*)&materialCount, 4);
+	float colors[11] = { 0.8f, 0.8f, 0.8f, 1, 5, 0.2f, 0.2f, 0.2f, 0.1f, 0.1f, 0.1f }; // diffuse, alpha, shininess, specular, ambient
+	out.write((const char*)colors, sizeof(colors));
+	char flags[2] = { 0, 1 }; // toon number and edge flag
+	out.write(flags, sizeof(flags));
+	out.write((const char*)&indexCount, 4);
+	char texture[20] = { 0 };
+	out.write(texture, sizeof(texture));
+
+	uint16_t empty[3] = { 0, 0, 0 }; // no bones, ik chains or skins
+	out.write((const char*)empty, sizeof(empty));
+	return vertexCount;
+}
+
+
+static void writeColladaHeader(std::ostream &out)
+{
+	out << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+	out << "<COLLADA xmlns=\"http://www.collada.org/2005/11/COLLADASchema\" version=\"1.4.1\">\n";
+	out << "<asset><unit name=\"meter\" meter=\"1\"/><up_axis>Y_UP</up_axis></asset>\n";
+}
+
+//params are the names of the values in an element, separated by spaces
+static void writeColladaSource(std::ostream &out, const std::string &id, const std::vector<float> &values, const std::string &params, int stride, const char* type = "float")
+{
+	out << "<source id=\"" << id << "\"><float_array id=\"" << id << "-array\" count=\"" << values.size() << "\">";
+	writeFloats(out, values);
+	out << "</float_array><technique_common><accessor source=\"#" << id << "-array\" count=\"" << values.size() / stride << "\" stride=\"" << stride << "\">";
+	std::istringstream names(params);
+	std::string name;
+	while (names >> name)
+		out << "<param name=\"" << name << "\" type=\"" << type << "\"/>";
+	out << "</accessor></technique_common></source>\n";
+}
+
+static void writeColladaMesh(std::ostream &out, const std::vector<float> &positions, const std::vector<float> &normals, const std::vector<float> &uvs, const std::vector<int> &indices)
+{
+	out << "<library_geometries><geometry id=\"mesh\" name=\"mesh\"><mesh>\n";
+	writeColladaSource(out, "mesh-positions", positions, "X Y Z", 3);
+	writeColladaSource(out, "mesh-normals", normals, "X Y Z", 3);
+	writeColladaSource(out, "mesh-uvs", uvs, "S T", 2);
+	out << "<vertices id=\"mesh-vertices\"><input semantic=\"POSITION\" source=\"#mesh-positions\"/></vertices>\n";
+	out << "<triangles count=\"" << indices.size() / 3 << "\">";
+	out << "<input semantic=\"VERTEX\" source=\"#mesh-vertices\" offset=\"0\"/>";
+	out << "<input semantic=\"NORMAL\" source=\"#mesh-normals\" offset=\"0\"/>";
+	out << "<input semantic=\"TEXCOORD\" source=\"#mesh-uvs\" offset=\"0\" set=\"0\"/><p>";
+	writeInts(out, indices);
+	out << "</p></triangles>\n</mesh></geometry></library_geometries>\n";
+}
+
+//a uv sphere, (segments/2+1)*(segments+1) vertices
+static long long writeSphereDae(const std::string &filename, int segments)
+{
+	int rings = segments / 2;
+	std::vector<float> positions, normals, uvs;
+	std::vector<int> indices;
+	for (int ring = 0; ring <= rings; ring++)
+	{
+		float theta = ring * 3.14159265f / rings;
+		for (int segment = 0; segment <= segments; segment++)
+		{
+			float phi = segment * 2 * 3.14159265f / segments;
+			float normal[3] = { sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi) };
+			for (int i = 0; i < 3; i++)
+			{
+				positions.push_back(normal[i] * 5);
+				normals.push_back(normal[i]);
+			}
+			uvs.push_back(segment / (float)segments);
+			uvs.push_back(ring / (float)rings);
+		}
+	}
+	for (int ring = 0; ring < rings; ring++)
+	{
+		for (int segment = 0; segment < segments; segment++)
+		{
+			int i = ring * (segments + 1) + segment;
+			int quad[6] = { i, i + 1, i + segments + 1, i + 1, i + segments + 2, i + segments + 1 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+
+	std::ofstream out(filename.c_str());
+	writeColladaHeader(out);
+	writeColladaMesh(out, positions, normals, uvs, indices);
+	out << "<library_visual_scenes><visual_scene id=\"scene\"><node id=\"sphere\" name=\"sphere\"><instance_geometry url=\"#mesh\"/></node></visual_scene></library_visual_scenes>\n";
+	out << "<scene><instance_visual_scene url=\"#scene\"/></scene>\n</COLLADA>\n";
+	return positions.size() / 3;
+}
+
+static void writeMatrix(std::ostream &out, float angle, float y)
+{
+	char buf[128];
+	snprintf(buf, sizeof(buf), "%g %g 0 0 %g %g 0 %g 0 0 1 0 0 0 0 1", cosf(angle), -sinf(angle), sinf(angle), cosf(angle), y);
+	out << buf;
+}
+
+//a standing grid, skinned to a chain of bones that bend back and forth in every clip
+static long long writeRigDae(const std::string &filename, int side, int bones, int clips)
+{
+	std::vector<float> positions, normals, uvs;
+	std::vector<int> indices;
+	grid(side, (float)bones, 0, 1, positions, normals, uvs, indices);
+
+	std::ofstream out(filename.c_str());
+	writeColladaHeader(out);
+	writeColladaMesh(out, positions, normals, uvs, indices);
+
+	//every vertex is weighted between the two bones nearest to it
+	std::vector<float> weights;
+	std::vector<int> counts;
+	std::vector<int> influences;
+	for (size_t i = 0; i < positions.size() / 3; i++)
+	{
+		float y = positions[i * 3 + 1];
+		int bone = std::min(bones - 1, (int)y);
+		float blend = y - bone;
+		if (bone + 1 < bones && blend > 0)
+		{
+			counts.push_back(2);
+			int influence[4] = { bone, (int)weights.size(), bone + 1, (int)weights.size() + 1 };
+			influences.insert(influences.end(), influence, influence + 4);
+			weights.push_back(1 - blend);
+			weights.push_back(blend);
+		}
+		else
+		{
+			counts.push_back(1);
+			influences.push_back(bone);
+			influences.push_back((int)weights.size());
+			weights.push_back(1);
+		}
+	}
+	std::vector<float> bindPoses;
+	for (int bone = 0; bone < bones; bone++)
+	{
+		float inverse[16] = { 1, 0, 0, 0, 0, 1, 0, -(float)bone, 0, 0, 1, 0, 0, 0, 0, 1 };
+		bindPoses.insert(bindPoses.end(), inverse, inverse + 16);
+	}
+
+	out << "<library_controllers><controller id=\"skin\"><skin source=\"#mesh\">\n";
+	out << "<bind_shape_matrix>1 0 0 0 0 1 0 0 0 0 1 0 0 0 0 1</bind_shape_matrix>\n";
+	out << "<source id=\"skin-joints\"><Name_array id=\"skin-joints-array\" count=\"" << bones << "\">";
+	for (int bone = 0; bone < bones; bone++)
+		out << "bone" << bone << (bone + 1 < bones ? " " : "");
+	out << "</Name_array><technique_common><accessor source=\"#skin-joints-array\" count=\"" << bones << "\" stride=\"1\"><param name=\"JOINT\" type=\"name\"/></accessor></technique_common></source>\n";
+	writeColladaSource(out, "skin-bind-poses", bindPoses, "TRANSFORM", 16, "float4x4");
+	writeColladaSource(out, "skin-weights", weights, "WEIGHT", 1);
+	out << "<joints><input semantic=\"JOINT\" source=\"#skin-joints\"/><input semantic=\"INV_BIND_MATRIX\" source=\"#skin-bind-poses\"/></joints>\n";
+	out << "<vertex_weights count=\"" << counts.size() << "\"><input semantic=\"JOINT\" source=\"#skin-joints\" offset=\"0\"/>";
+	out << "<input semantic=\"WEIGHT\" source=\"#skin-weights\" offset=\"1\"/><vcount>";
+	writeInts(out, counts);
+	out << "</vcount><v>";
+	writeInts(out, influences);
+	out << "</v></vertex_weights>\n</skin></controller></library_controllers>\n";
+
+	out << "<library_animations>\n";
+	for (int clip = 0; clip < clips; clip++)
+	{
+		out << "<animation id=\"clip" << clip << "\" name=\"clip" << clip << "\">\n";
+		for (int bone = 0; bone < bones; bone++)
+		{
+			std::ostringstream id;
+			id << "clip" << clip << "-bone" << bone;
+			std::vector<float> times;
+			for (int key = 0; key < rigKeys; key++)
+				times.push_back(key / 30.0f);
+			out << "<animation id=\"" << id.str() << "\">";
+			writeColladaSource(out, id.str() + "-input", times, "TIME", 1);
+			out << "<source id=\"" << id.str() << "-output\"><float_array id=\"" << id.str() << "-output-array\" count=\"" << rigKeys * 16 << "\">";
+			for (int key = 0; key < rigKeys; key++)
+			{
+				writeMatrix(out, 0.3f * sinf(key * 2 * 3.14159265f / rigKeys + clip), bone == 0 ? 0.0f : 1.0f);
+				out << " ";
+			}
+			out << "</float_array><technique_common><accessor source=\"#" << id.str() << "-output-array\" count=\"" << rigKeys << "\" stride=\"16\"><param name=\"TRANSFORM\" type=\"float4x4\"/></accessor></technique_common></source>";
+			out << "<source id=\"" << id.str() << "-interpolation\"><Name_array id=\"" << id.str() << "-interpolation-array\" count=\"" << rigKeys << "\">";
+			for (int key = 0; key < rigKeys; key++)
+				out << "LINEAR ";
+			out << "</Name_array><technique_common><accessor source=\"#" << id.str() << "-interpolation-array\" count=\"" << rigKeys << "\" stride=\"1\"><param name=\"INTERPOLATION\" type=\"name\"/></accessor></technique_common></source>";
+			out << "<sampler id=\"" << id.str() << "-sampler\"><input semantic=\"INPUT\" source=\"#" << id.str() << "-input\"/>";
+			out << "<input semantic=\"OUTPUT\" source=\"#" << id.str() << "-output\"/><input semantic=\"INTERPOLATION\" source=\"#" << id.str() << "-interpolation\"/></sampler>";
+			out << "<channel source=\"#" << id.str() << "-sampler\" target=\"bone" << bone << "/transform\"/></animation>\n";
+		}
+		out << "</animation>\n";
+	}
+	out << "</library_animations>\n";
+
+	out << "<library_visual_scenes><visual_scene id=\"scene\">\n";
+	for (int bone = 0; bone < bones; bone++)
+	{
+		out << "<node id=\"bone" << bone << "\" sid=\"bone" << bone << "\" name=\"bone" << bone << "\" type=\"JOINT\"><matrix sid=\"transform\">";
+		writeMatrix(out, 0, bone == 0 ? 0.0f : 1.0f);
+		out << "</matrix>\n";
+	}
+	for (int bone = 0; bone < bones; bone++)
+		out << "</node>";
+	out << "\n<node id=\"rig\" name=\"rig\"><instance_controller url=\"#skin\"><skeleton>#bone0</skeleton></instance_controller></node>\n";
+	out << "</visual_scene></library_visual_scenes>\n";
+	out << "<scene><instance_visual_scene url=\"#scene\"/></scene>\n</COLLADA>\n";
+	return positions.size() / 3;
+}
+
+
+static long long fileSize(const std::string &filename)
+{
+	std::ifstream file(filename.c_str(), std::ios_base::binary | std::ios_base::in | std::ios_base::ate);
+	return file.is_open() ? (long long)file.tellg() : 0;
+}
+
+typedef std::map<std::string, std::vector<double> > Samples;	// seconds of every run, per conversion and per stage
+
+static double median(std::vector<double> values)
+{
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	size_t middle = values.size() / 2;
+	return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+//median absolute deviation, a spread that one slow run caused by the machine does not blow up
+static double medianDeviation(const std::vector<double> &values)
+{
+	double center = median(values);
+	std::vector<double> deviations;
+	for (size_t i = 0; i < values.size(); i++)
+		deviations.push_back(fabs(values[i] - center));
+	return median(deviations);
+}
+
+//returns the lines for the result table, the converters log too much to print them right away. A conversion that
+//fails is counted in failures
+static std::string timeConversion(const char* path, const std::string &filename, long long vertices, int repeats, Samples &samples, int &failures,
+	const std::function<blib::json::Value(std::vector<std::string>&)> &convert)
+{
+	std::string name = filename.substr(filename.find_last_of("/\\") + 1);
+	std::string key = std::string(path) + " " + name;
+	char buf[256];
+	std::vector<std::map<std::string, double> > runStages;
+	for (int i = 0; i < repeats; i++)
+	{
+		trace.takeStageTimes(); // drops what was recorded outside the conversion
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::vector<std::string> outputFiles;
+		blib::json::Value data = convert(outputFiles);
+		if (!data.isNull())
+		{
+			std::ostringstream out;
+			writeModel(data, out);
+		}
+		double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (data.isNull() && outputFiles.empty())
+		{
+			snprintf(buf, sizeof(buf), "%-18s %-32s could not be converted\n", path, name.c_str());
+			failures++;
+			return buf;
+		}
+		samples[key].push_back(time);
+		runStages.push_back(trace.takeStageTimes());
+	}
+	//a stage that did not run in some run counts as 0 there
+	for (size_t i = 0; i < runStages.size(); i++)
+		for (std::map<std::string, double>::iterator it = runStages[i].begin(); it != runStages[i].end(); it++)
+			if (it->second > 0)
+				samples[key + " / " + it->first].resize(repeats, 0);
+	for (size_t i = 0; i < runStages.size(); i++)
+		for (std::map<std::string, double>::iterator it = runStages[i].begin(); it != runStages[i].end(); it++)
+			if (it->second > 0)
+				samples[key + " / " + it->first][i] = it->second;
+
+	double time = median(samples[key]);
+	snprintf(buf, sizeof(buf), "%-18s %-32s %10lld %9.3f %8.3f %14.0f %9.2f\n", path, name.c_str(), vertices, time, medianDeviation(samples[key]),
+		vertices / time, fileSize(filename) / (1024.0 * 1024.0) / time);
+	std::string lines = buf;
+	std::vector<std::pair<double, std::string> > stages;
+	for (Samples::iterator it = samples.lower_bound(key + " / "); it != samples.end() && it->first.compare(0, key.size() + 3, key + " / ") == 0; it++)
+		if (median(it->second) >= time * 0.01)
+			stages.push_back(std::make_pair(median(it->second), it->first.substr(key.size() + 3)));
+	std::sort(stages.rbegin(), stages.rend());
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		snprintf(buf, sizeof(buf), "    %-46s %9.3f %5.0f%%\n", stages[i].second.c_str(), stages[i].first, 100 * stages[i].first / time);
+		lines += buf;
+	}
+	return lines;
+}
+
+static bool saveBaseline(const std::string &filename, const Samples &samples, int repeats)
+{
+	blib::json::Value baseline(blib::json::Type::objectValue);
+	baseline["version"] = 1;
+	baseline["repeats"] = repeats;
+	baseline["results"] = blib::json::Value(blib::json::Type::objectValue);
+	baseline["names"] = blib::json::Value(blib::json::Type::arrayValue); // so results missing from a later run can be found
+	for (Samples::const_iterator it = samples.begin(); it != samples.end(); it++)
+	{
+		baseline["names"].push_back(it->first);
+		baseline["results"][it->first]["median"] = (float)median(it->second);
+		baseline["results"][it->first]["mad"] = (float)medianDeviation(it->second);
+	}
+	std::ofstream out(filename.c_str());
+	if (!out.is_open())
+		return false;
+	out << baseline;
+	return (bool)out;
+}
+
+//a stage regressed when its median is more than threshold percent slower, and the difference is well outside the noise
+//of both runs, or when it is in the baseline but did not run now. Very short stages are skipped, their timings are mostly
+//noise. Returns the number of regressions
+static int compareBaseline(const std::string &filename, const Samples &samples, float threshold)
+{
+	std::ifstream file(filename.c_str());
+	std::stringstream data;
+	data << file.rdbuf();
+	blib::json::Value baseline = blib::json::readJson(data.str());
+	if (!file.is_open() || !baseline.isObject() || !baseline.isMember("results"))
+	{
+		printf("Could not read baseline %s\n", filename.c_str());
+		return -1;
+	}
+
+	int regressions = 0;
+	printf("\nCompared with %s, regressions over %.0f%%:\n", filename.c_str(), threshold);
+	printf("%-80s %9s %9s %7s\n", "", "baseline", "now", "change");
+	for (Samples::const_iterator it = samples.begin(); it != samples.end(); it++)
+	{
+		if (!baseline["results"].isMember(it->first))
+			continue;
+		const blib::json::Value &old = baseline["results"][it->first];
+		double before = old["median"].asFloat();
+		double now = median(it->second);
+		double noise = 3 * 1.4826 * std::max((double)old["mad"].asFloat(), medianDeviation(it->second)); // 1.4826 scales the MAD to a standard deviation
+		if (std::max(before, now) < 0.001)
+			continue;
+		if (now > before * (1 + threshold / 100) && now - before > noise)
+		{
+			printf("%-80s %9.4f %9.4f %+6.0f%%\n", it->first.c_str(), before, now, 100 * (now - before) / before);
+			regressions++;
+		}
+	}
+	for (size_t i = 0; i < baseline["names"].size(); i++)
+	{
+		std::string name = baseline["names"][(int)i].asString();
+		if (samples.find(name) != samples.end() || !baseline["results"].isMember(name))
+			continue;
+		printf("%-80s %9.4f %9s\n", name.c_str(), baseline["results"][name]["median"].asFloat(), "missing");
+		regressions++;
+	}
+	if (regressions == 0)
+		printf("none\n");
+	return regressions;
+}
+
+
+int runBenchmark(const std::string &directory, const Options &options)
+{
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+	trace.open(""); // the stage times come from the trace, without writing it. The events are dropped after every run
+
+	printf("Writing benchmark models to %s\n", directory.c_str());
+	struct Model
+	{
+		const char* path;
+		std::string filename;
+		long long vertices;
+	};
+	std::vector<Model> models;
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(int); i++)
+	{
+		std::string size = std::to_string(sizes[i]);
+		Model pmd = { "convertPmd", directory + "/grid" + size + ".pmd", 0 };
+		pmd.vertices = writeGridPmd(pmd.filename, sizes[i]);
+		Model obj = { "convertAssimp", directory + "/grid" + size + ".obj", 0 };
+		obj.vertices = writeGridObj(obj.filename, sizes[i]);
+		Model dae = { "convertAssimp", directory + "/sphere" + size + ".dae", 0 };
+		dae.vertices = writeSphereDae(dae.filename, sizes[i]);
+		Model rig = { "convertAssimpAnim", directory + "/rig" + size + "-" + std::to_string(rigBones) + "bones-" + std::to_string(rigClips) + "clips.dae", 0 };
+		rig.vertices = writeRigDae(rig.filename, sizes[i], rigBones, rigClips);
+		models.push_back(pmd);
+		models.push_back(obj);
+		Model nativeObj = { "native obj", obj.filename, obj.vertices };
+		models.push_back(nativeObj);
+		models.push_back(dae);
+		models.push_back(rig);
+	}
+
+	int repeats = std::max(1, options.benchmarkRepeats);
+	int failures = 0;
+	Samples samples;
+	std::vector<std::string> results;
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		const Model &model = models[i];
+		std::string path = model.path;
+		if (path == "convertPmd")
+			results.push_back(timeConversion(model.path, model.filename, model.vertices, repeats, samples, failures, [&model](std::vector<std::string>&) { blib::json::Value skeleton; return convertPmd(model.filename, skeleton); }));
+		else if (path == "convertAssimp")
+			results.push_back(timeConversion(model.path, model.filename, model.vertices, repeats, samples, failures, [&model, &options](std::vector<std::string> &outputFiles) { return convertAssimp(model.filename, options, outputFiles); }));
+		else if (path == "native obj")
+		{
+			Options nativeOptions = options;
+			nativeOptions.nativeObj = true;
+			results.push_back(timeConversion(model.path, model.filename, model.vertices, repeats, samples, failures, [&model, &nativeOptions](std::vector<std::string> &outputFiles) { return convertAssimp(model.filename, nativeOptions, outputFiles); }));
+		}
+		else
+			results.push_back(timeConversion(model.path, model.filename, model.vertices, repeats, samples, failures, [&model, &options](std::vector<std::string> &outputFiles) { return convertAssimpAnim(model.filename, options, outputFiles); }));
+	}
+
+	printf("\nMedian of %i runs, with the stages that took at least 1%% of it (stages on threads and nested stages overlap)\n", repeats);
+	printf("%-18s %-32s %10s %9s %8s %14s %9s\n", "path", "model", "vertices", "seconds", "mad", "vertices/s", "MB/s");
+	for (size_t i = 0; i < results.size(); i++)
+		printf("%s", results[i].c_str());
+
+	if (failures > 0)
+		printf("\n%i conversions failed\n", failures);
+
+	if (!options.saveBaseline.empty() && failures > 0)
+		printf("Not writing baseline %s, it would be missing the failed conversions\n", options.saveBaseline.c_str());
+	else if (!options.saveBaseline.empty())
+	{
+		if (!saveBaseline(options.saveBaseline, samples, repeats))
+		{
+			printf("Could not write baseline %s\n", options.saveBaseline.c_str());
+			return -1;
+		}
+		printf("Wrote baseline %s\n", options.saveBaseline.c_str());
+	}
+	if (!options.baseline.empty() && compareBaseline(options.baseline, samples, options.regressionThreshold) != 0)
+		return -1;
+	return failures > 0 ? -1 : 0;
+}
@@ -0,0 +1,268 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <assimp/scene.h>
+
+#include "ModelConvert.h"
+#include "Logger.h"
+
+// Binary animation clip, little endian. The file is laid out as
+//   AnimHeader
+//   name (nameLength bytes, padded with zeroes to a multiple of 4)
+//   AnimChannel[channelCount]
+//   AnimVectorKey[positionKeyCount]	all position keys, channels index into this with positionStart
+//   AnimQuatKey[rotationKeyCount]
+//   AnimVectorKey[scaleKeyCount]
+// so the whole file can be copied into memory and used as is.
+#pragma pack(push)
+#pragma pack(1)
+struct AnimHeader
+{
+	char magic[4];				// "BANM"
+	uint16_t version;
+	uint16_t channelCount;
+	float length;				// in seconds
+	float frameRate;			// key times are frame indices at this rate
+	uint32_t nameLength;
+	uint32_t positionKeyCount;
+	uint32_t rotationKeyCount;
+	uint32_t scaleKeyCount;
+};
+
+struct AnimChannel
+{
+	int32_t bone;				// index in the skeleton, -1 if the channel does not target a bone
+	uint32_t positionStart;
+	uint32_t rotationStart;
+	uint32_t scaleStart;
+	uint16_t positionCount;
+	uint16_t rotationCount;
+	uint16_t scaleCount;
+	uint16_t padding;
+	float positionMin[3];		// value = min + quantized / 65535 * extent
+	float positionExtent[3];
+	float scaleMin[3];
+	float scaleExtent[3];
+};
+
+struct AnimVectorKey
+{
+	uint16_t frame;
+	uint16_t value[3];
+};
+
+// smallest three: the largest component is left out and rebuilt from the other three, as the quaternion has length 1.
+// bits 46-45 hold the index of the left out component, bits 44-30, 29-15 and 14-0 the other three in order,
+// each mapped from [-1/sqrt(2), 1/sqrt(2)] to [0, 32767]. The 48 bits are stored most significant word first
+struct AnimQuatKey
+{
+	uint16_t frame;
+	uint16_t value[3];
+};
+#pragma pack(pop)
+
+
+static const float quatRange = 0.70710678f; // 1/sqrt(2), the largest a component other than the largest one can be
+
+static uint16_t quantize(float value, float min, float extent, int max)
+{
+	if (extent <= 0)
+		return 0;
+	float fac = std::min(1.0f, std::max(0.0f, (value - min) / extent));
+	return (uint16_t)floor(fac * max + 0.5f);
+}
+
+static void packQuaternion(const aiQuaternion& rot, uint16_t* out)
+{
+	float values[4] = { rot.x, rot.y, rot.z, rot.w };
+	int largest = 0;
+	for (int i = 1; i < 4; i++)
+		if (fabs(values[i]) > fabs(values[largest]))
+			largest = i;
+	float sign = values[largest] < 0 ? -1.0f : 1.0f; // q and -q are the same rotation, so make sure the left out component is positive
+
+	uint64_t packed = (uint64_t)largest << 45;
+	int shift = 30;
+	for (int i = 0; i < 4; i++)
+	{
+		if (i == largest)
+			continue;
+		packed |= (uint64_t)quantize(values[i] * sign, -quatRange, 2 * quatRange, 32767) << shift;
+		shift -= 15;
+	}
+	out[0] = (uint16_t)(packed >> 32);
+	out[1] = (uint16_t)(packed >> 16);
+	out[2] = (uint16_t)packed;
+}
+
+static void vectorRange(const aiVectorKey* keys, unsigned int count, float* min, float* extent)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		min[i] = 0;
+		extent[i] = 0;
+	}
+	if (count == 0)
+		return;
+	aiVector3D low = keys[0].mValue;
+	aiVector3D high = keys[0].mValue;
+	for (unsigned int i = 1; i < count; i++)
+	{
+		for (int ii = 0; ii < 3; ii++)
+		{
+			low[ii] = std::min(low[ii], keys[i].mValue[ii]);
+			high[ii] = std::max(high[ii], keys[i].mValue[ii]);
+		}
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		min[i] = low[i];
+		extent[i] = high[i] - low[i];
+	}
+}
+
+
+//smallest time between two keys of a track that are not at the same time, in ticks
+template<class Key>
+static double smallestSpacing(const Key* keys, unsigned int count, double spacing)
+{
+	for (unsigned int i = 1; i < count; i++)
+		if (keys[i].mTime > keys[i - 1].mTime)
+			spacing = std::min(spacing, keys[i].mTime - keys[i - 1].mTime);
+	return spacing;
+}
+
+static uint16_t frameNumber(double frame)
+{
+	return (uint16_t)std::min(65535.0, std::max(0.0, floor(frame + 0.5)));
+}
+
+static const float defaultFrameRate = 30;
+static const float maxFrameRate = 240;	// keys closer together than this are merged, past this the frame numbers run out quickly
+
+
+bool writeBinaryAnimation(const std::string &filename, const aiAnimation* animation, const std::vector<int> &bindings, const Options &options)
+{
+	double tps = animation->mTicksPerSecond != 0 ? animation->mTicksPerSecond : 25;
+	float length = (float)(animation->mDuration / tps);
+
+	//key times are stored as frame numbers. Resampled clips use the resample rate, exportAnimation already put their keys
+	//on those frames. The others use a rate that keeps the closest keys on separate frames. Ticks are not a frame rate,
+	//collada files have 1 tick per second with times in seconds
+	float frameRate = options.resampleRate;
+	if (frameRate <= 0)
+	{
+		double spacing = 1e30;
+		for (unsigned int i = 0; i < animation->mNumChannels; i++)
+		{
+			const aiNodeAnim* stream = animation->mChannels[i];
+			spacing = smallestSpacing(stream->mPositionKeys, stream->mNumPositionKeys, spacing);
+			spacing = smallestSpacing(stream->mRotationKeys, stream->mNumRotationKeys, spacing);
+			spacing = smallestSpacing(stream->mScalingKeys, stream->mNumScalingKeys, spacing);
+		}
+		frameRate = defaultFrameRate;
+		if (spacing < 1e30)
+			frameRate = std::min(maxFrameRate, std::max(frameRate, (float)ceil(tps / spacing)));
+	}
+	if (length * frameRate > 65535)
+	{
+		frameRate = 65535 / length;
+		LOG(Warning) << "Animation " << animation->mName.C_Str() << " is too long for 16 bit frame numbers, storing key times at " << frameRate << " frames per second";
+	}
+
+	for (unsigned int i = 0; i < animation->mNumChannels; i++)
+	{
+		const aiNodeAnim* stream = animation->mChannels[i];
+		if (stream->mNumPositionKeys > 65535 || stream->mNumRotationKeys > 65535 || stream->mNumScalingKeys > 65535)
+		{
+			LOG(Error) << "Animation " << animation->mName.C_Str() << " has more than 65535 keys in channel " << stream->mNodeName.C_Str() << ", which does not fit in a binary animation. Reduce or resample it";
+			return false;
+		}
+	}
+
+	AnimHeader header;
+	memcpy(header.magic, "BANM", 4);
+	header.version = 1;
+	header.channelCount = (uint16_t)animation->mNumChannels;
+	header.length = length;
+	header.frameRate = frameRate;
+	header.nameLength = (uint32_t)animation->mName.length;
+
+	std::vector<AnimChannel> channels(animation->mNumChannels);
+	std::vector<AnimVectorKey> positions;
+	std::vector<AnimQuatKey> rotations;
+	std::vector<AnimVectorKey> scales;
+
+	for (unsigned int i = 0; i < animation->mNumChannels; i++)
+	{
+		const aiNodeAnim* stream = animation->mChannels[i];
+		AnimChannel& channel = channels[i];
+		memset(&channel, 0, sizeof(AnimChannel));
+		channel.bone = bindings[i];
+		channel.positionStart = (uint32_t)positions.size();
+		channel.rotationStart = (uint32_t)rotations.size();
+		channel.scaleStart = (uint32_t)scales.size();
+		channel.positionCount = (uint16_t)stream->mNumPositionKeys;
+		channel.rotationCount = (uint16_t)stream->mNumRotationKeys;
+		channel.scaleCount = (uint16_t)stream->mNumScalingKeys;
+		vectorRange(stream->mPositionKeys, channel.positionCount, channel.positionMin, channel.positionExtent);
+		vectorRange(stream->mScalingKeys, channel.scaleCount, channel.scaleMin, channel.scaleExtent);
+
+		for (unsigned int ii = 0; ii < channel.positionCount; ii++)
+		{
+			AnimVectorKey key;
+			key.frame = frameNumber(stream->mPositionKeys[ii].mTime / tps * frameRate);
+			for (int iii = 0; iii < 3; iii++)
+				key.value[iii] = quantize(stream->mPositionKeys[ii].mValue[iii], channel.positionMin[iii], channel.positionExtent[iii], 65535);
+			positions.push_back(key);
+		}
+		for (unsigned int ii = 0; ii < channel.rotationCount; ii++)
+		{
+			AnimQuatKey key;
+			key.frame = frameNumber(stream->mRotationKeys[ii].mTime / tps * frameRate);
+			packQuaternion(stream->mRotationKeys[ii].mValue, key.value);
+			rotations.push_back(key);
+		}
+		for (unsigned int ii = 0; ii < channel.scaleCount; ii++)
+		{
+			AnimVectorKey key;
+			key.frame = frameNumber(stream->mScalingKeys[ii].mTime / tps * frameRate);
+			for (int iii = 0; iii < 3; iii++)
+				key.value[iii] = quantize(stream->mScalingKeys[ii].mValue[iii], channel.scaleMin[iii], channel.scaleExtent[iii], 65535);
+			scales.push_back(key);
+		}
+	}
+
+	header.positionKeyCount = (uint32_t)positions.size();
+	header.rotationKeyCount = (uint32_t)rotations.size();
+	header.scaleKeyCount = (uint32_t)scales.size();
+
+	std::ofstream out(filename.c_str(), std::ios_base::binary | std::ios_base::out);
+	if (!out.is_open())
+	{
+		LOG(Error) << "Could not open " << filename << " for writing";
+		return false;
+	}
+	char padding[4] = { 0, 0, 0, 0 };
+	out.write((char*)&header, sizeof(AnimHeader));
+	out.write(animation->mName.data, header.nameLength);
+	out.write(padding, (4 - header.nameLength % 4) % 4);
+	if (!channels.empty())
+		out.write((char*)&channels[0], channels.size() * sizeof(AnimChannel));
+	if (!positions.empty())
+		out.write((char*)&positions[0], positions.size() * sizeof(AnimVectorKey));
+	if (!rotations.empty())
+		out.write((char*)&rotations[0], rotations.size() * sizeof(AnimQuatKey));
+	if (!scales.empty())
+		out.write((char*)&scales[0], scales.size() * sizeof(AnimVectorKey));
+
+	LOG(Info) << "Animation " << animation->mName.C_Str() << ": wrote " << (int)out.tellp() << " bytes to " << filename;
+	out.close();
+	return true;
+}
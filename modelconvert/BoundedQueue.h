@@ -0,0 +1,50 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// Queue between two threads. push blocks while the queue is full, pop blocks while it is empty and returns false
+// once the queue is closed and empty
+template<class T>
+class BoundedQueue
+{
+	std::deque<T> items;
+	size_t maxSize;
+	bool closed;
+	std::mutex mutex;
+	std::condition_variable changed;
+public:
+	BoundedQueue(size_t maxSize) : maxSize(maxSize < 1 ? 1 : maxSize), closed(false)
+	{
+	}
+
+	void push(const T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (items.size() >= maxSize)
+			changed.wait(lock);
+		items.push_back(item);
+		changed.notify_all();
+	}
+
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (items.empty() && !closed)
+			changed.wait(lock);
+		if (items.empty())
+			return false;
+		item = items.front();
+		items.pop_front();
+		changed.notify_all();
+		return true;
+	}
+
+	void close()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		closed = true;
+		changed.notify_all();
+	}
+};
@@ -0,0 +1,391 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdint.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#endif
+
+#include "Cache.h"
+#include "ModelConvert.h"
+#include "Logger.h"
+
+// bump this whenever a change anywhere in the converter changes its output files, the cache only knows about the inputs
+#define CONVERTER_VERSION 2
+
+
+static uint64_t hashBytes(uint64_t hash, const char* data, size_t len)
+{
+	//FNV-1a
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint64_t hashString(uint64_t hash, const std::string &data)
+{
+	hash = hashBytes(hash, data.c_str(), data.size() + 1); // include the terminator, so "ab"+"c" differs from "a"+"bc"
+	return hash;
+}
+
+//returns false when the file can't be read
+static bool hashFile(uint64_t &hash, const std::string &filename)
+{
+	std::ifstream file(filename.c_str(), std::ios_base::binary | std::ios_base::in);
+	if (!file.is_open())
+		return false;
+	char buf[65536];
+	while (file)
+	{
+		file.read(buf, sizeof(buf));
+		hash = hashBytes(hash, buf, (size_t)file.gcount());
+	}
+	return !file.bad();
+}
+
+static std::string hexHash(uint64_t hash)
+{
+	char buf[32];
+	sprintf(buf, "%016llx", (unsigned long long)hash);
+	return buf;
+}
+
+//hash of the contents of a file, empty when it can't be read
+static std::string contentHash(const std::string &filename)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	return hashFile(hash, filename) ? hexHash(hash) : "";
+}
+
+//sizes are written as strings, json numbers are ints and floats, which don't hold the size of a large output
+static long long sizeValue(const blib::json::Value &value)
+{
+	if (value.isString())
+		return strtoll(value.asString().c_str(), NULL, 10);
+	return value.asInt();
+}
+
+static long long fileSize(const std::string &filename)
+{
+	std::ifstream file(filename.c_str(), std::ios_base::binary | std::ios_base::in | std::ios_base::ate);
+	if (!file.is_open())
+		return -1;
+	return (long long)file.tellg();
+}
+
+static bool copyFile(const std::string &from, const std::string &to)
+{
+	std::ifstream in(from.c_str(), std::ios_base::binary | std::ios_base::in);
+	std::ofstream out(to.c_str(), std::ios_base::binary | std::ios_base::out);
+	if (!in.is_open() || !out.is_open())
+		return false;
+	if (in.peek() != EOF)
+		out << in.rdbuf();
+	return (bool)out;
+}
+
+static bool linkFile(const std::string &from, const std::string &to)
+{
+	remove(to.c_str());
+#ifdef _WIN32
+	return CreateHardLinkA(to.c_str(), from.c_str(), NULL) != 0;
+#else
+	return link(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+//every option that changes the output files has to be in here
+static std::string optionsKey(const Options &options)
+{
+	std::ostringstream key;
+	key << "flags " << options.importFlags << " native " << options.nativeSteps << " " << options.nativeObj;
+	key << " resample " << options.resampleRate;
+	key << " reduce " << options.reducePosition << " " << options.reduceRotation << " " << options.reduceScale;
+	key << " binary " << options.binaryAnimations;
+	return key.str();
+}
+
+
+//files next to the model that change the conversion result
+std::vector<std::string> sideFiles(const std::string &filename)
+{
+	std::vector<std::string> ret;
+	if (fileExtension(filename) != ".obj")
+		return ret;
+
+	size_t slash = filename.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+	std::ifstream file(filename.c_str());
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.compare(0, 7, "mtllib ") != 0)
+			continue;
+		std::istringstream names(line.substr(7));
+		std::string name;
+		while (names >> name)
+			ret.push_back(directory + name);
+	}
+	return ret;
+}
+
+
+//hash of the model, its side files and salt, as 16 hex digits. Empty when one of the files can't be read, a key
+//that does not depend on the contents of a file would match again once the file is back, with different contents
+std::string inputHash(const std::string &filename, const std::string &salt)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	hash = hashString(hash, salt);
+	hash = hashString(hash, fileExtension(filename)); // the extension picks the importer
+	if (!hashFile(hash, filename))
+		return "";
+
+	std::vector<std::string> files = sideFiles(filename);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		hash = hashString(hash, files[i].substr(files[i].find_last_of("/\\") + 1));
+		if (!hashFile(hash, files[i]))
+			return "";
+	}
+	return hexHash(hash);
+}
+
+
+//holds an exclusive lock on the cache directory, other converters working on the same cache wait for it. The index
+//is read, changed and written under the lock, the atomic rename in saveIndex alone would lose the entries of all but
+//the last process to write it
+class IndexLock
+{
+#ifdef _WIN32
+	HANDLE file;
+#else
+	int file;
+#endif
+public:
+	IndexLock(const std::string &directory)
+	{
+		std::string filename = directory + "/index.lock";
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, 0, NULL);
+		OVERLAPPED overlapped;
+		ZeroMemory(&overlapped, sizeof(overlapped));
+		if (file != INVALID_HANDLE_VALUE && !LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped))
+			LOG(Warning) << "Could not lock the cache index, other converters may change it at the same time";
+#else
+		file = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+		while (file != -1 && flock(file, LOCK_EX) != 0 && errno == EINTR)
+			;
+#endif
+	}
+	~IndexLock()
+	{
+#ifdef _WIN32
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file); // also releases the lock
+#else
+		if (file != -1)
+			close(file);
+#endif
+	}
+};
+
+
+ConversionCache::ConversionCache(const std::string &directory, long long maxSize, bool useLinks)
+{
+	this->directory = directory;
+	this->maxSize = maxSize;
+	this->useLinks = useLinks;
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+}
+
+std::string ConversionCache::key(const std::string &filename, const Options &options)
+{
+	return inputHash(filename, "modelconvert " + std::to_string(CONVERTER_VERSION) + " " + optionsKey(options));
+}
+
+bool ConversionCache::restore(const std::string &key, const std::string &filename, const std::string &outfile)
+{
+	if (key.empty())
+		return false;
+	IndexLock lock(directory);
+	loadIndex();
+	int entry = findEntry(key);
+	if (entry == -1)
+		return false;
+
+	blib::json::Value &files = index["entries"][entry]["files"];
+	//with hard links, an output that was written over in place also changes the cached copy
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		std::string cached = directory + "/" + key + "." + std::to_string(i);
+		if (fileSize(cached) != sizeValue(files[(int)i]["size"]) || contentHash(cached) != files[(int)i]["hash"].asString())
+		{
+			LOG(Info) << "Cache entry " << key << " was changed, converting again";
+			removeEntry(entry);
+			saveIndex();
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		std::string name = files[(int)i]["name"].asString();
+		std::string cached = directory + "/" + key + "." + std::to_string(i);
+		std::string target = name.empty() ? outfile : filename + name;
+		if (!(useLinks && linkFile(cached, target)) && !copyFile(cached, target))
+		{
+			LOG(Warning) << "Could not restore " << target << " from the cache";
+			return false;
+		}
+		LOG(Info) << "Restored " << target << " from the cache";
+	}
+
+	index["entries"][entry]["used"] = (int)time(NULL);
+	saveIndex();
+	return true;
+}
+
+void ConversionCache::store(const std::string &key, const std::string &filename, const std::string &outfile, const std::vector<std::string> &outputs)
+{
+	if (key.empty())
+		return;
+	std::vector<std::string> names;
+	for (size_t i = 0; i < outputs.size(); i++)
+	{
+		if (outputs[i] == outfile)
+			names.push_back("");
+		else if (outputs[i].compare(0, filename.size(), filename) == 0)
+			names.push_back(outputs[i].substr(filename.size()));
+		else
+			return; //can't be restored for another input path
+	}
+
+	IndexLock lock(directory);
+	loadIndex();
+	int entry = findEntry(key);
+	if (entry != -1)
+		removeEntry(entry);
+
+	blib::json::Value newEntry;
+	newEntry["key"] = key;
+	newEntry["used"] = (int)time(NULL);
+	newEntry["files"] = blib::json::Value(blib::json::Type::arrayValue);
+	long long size = 0;
+	for (size_t i = 0; i < outputs.size(); i++)
+	{
+		blib::json::Value file;
+		file["name"] = names[i];
+		std::string cached = directory + "/" + key + "." + std::to_string(i);
+		if (!copyFile(outputs[i], cached))
+		{
+			LOG(Warning) << "Could not store " << outputs[i] << " in the cache";
+			for (size_t ii = 0; ii <= i; ii++)
+				remove((directory + "/" + key + "." + std::to_string(ii)).c_str());
+			saveIndex();
+			return;
+		}
+		file["size"] = std::to_string(fileSize(cached));
+		file["hash"] = contentHash(cached);
+		size += fileSize(cached);
+		newEntry["files"].push_back(file);
+	}
+	newEntry["size"] = std::to_string(size);
+	index["entries"].push_back(newEntry);
+
+	evict();
+	saveIndex();
+}
+
+void ConversionCache::loadIndex()
+{
+	index = blib::json::Value(blib::json::Type::objectValue);
+	std::ifstream file((directory + "/index.json").c_str());
+	if (file.is_open())
+	{
+		std::stringstream data;
+		data << file.rdbuf();
+		index = blib::json::readJson(data.str());
+	}
+	if (!index.isObject() || !index["entries"].isArray())
+	{
+		index = blib::json::Value(blib::json::Type::objectValue);
+		index["entries"] = blib::json::Value(blib::json::Type::arrayValue);
+	}
+}
+
+void ConversionCache::saveIndex()
+{
+	//write next to the old index and swap, so an interrupted run does not leave a broken index behind. Callers hold the
+	//IndexLock, the temporary file is named after the process all the same
+	std::string filename = directory + "/index.json";
+	std::string tmpFilename = filename + "." + std::to_string((long long)getpid()) + ".tmp";
+	{
+		std::ofstream file(tmpFilename.c_str());
+		file << index;
+	}
+	remove(filename.c_str());
+	rename(tmpFilename.c_str(), filename.c_str());
+}
+
+int ConversionCache::findEntry(const std::string &key)
+{
+	for (size_t i = 0; i < index["entries"].size(); i++)
+		if (index["entries"][(int)i]["key"].asString() == key)
+			return (int)i;
+	return -1;
+}
+
+void ConversionCache::removeEntry(int entry)
+{
+	std::string key = index["entries"][entry]["key"].asString();
+	for (size_t i = 0; i < index["entries"][entry]["files"].size(); i++)
+		remove((directory + "/" + key + "." + std::to_string(i)).c_str());
+
+	blib::json::Value entries(blib::json::Type::arrayValue);
+	for (size_t i = 0; i < index["entries"].size(); i++)
+		if ((int)i != entry)
+			entries.push_back(index["entries"][(int)i]);
+	index["entries"] = entries;
+}
+
+//removes the least recently used entries until the cache fits in maxSize
+void ConversionCache::evict()
+{
+	while (true)
+	{
+		long long total = 0;
+		int oldest = -1;
+		for (size_t i = 0; i < index["entries"].size(); i++)
+		{
+			total += sizeValue(index["entries"][(int)i]["size"]);
+			if (oldest == -1 || index["entries"][(int)i]["used"].asInt() < index["entries"][oldest]["used"].asInt())
+				oldest = (int)i;
+		}
+		if (total <= maxSize || oldest == -1)
+			return;
+		LOG(Info) << "Cache is over its size limit, removing " << index["entries"][oldest]["key"].asString();
+		removeEntry(oldest);
+	}
+}
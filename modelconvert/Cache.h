@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <blib/json.h>
+
+struct Options;
+
+// Stores conversion outputs under a hash of everything that goes into a conversion, so unchanged models
+// can be restored instead of converted again. The least recently used entries are removed when the cache
+// grows over its size limit. Each entry is kept as flat files <directory>/<key>.<n>, the bookkeeping is in <directory>/index.json.
+// Several converters can share a cache, the index is locked, read and written again for every restore and store
+class ConversionCache
+{
+	std::string directory;
+	long long maxSize;
+	bool useLinks;
+	blib::json::Value index;
+
+	void loadIndex();
+	void saveIndex();
+	int findEntry(const std::string &key);
+	void removeEntry(int entry);
+	void evict();
+public:
+	ConversionCache(const std::string &directory, long long maxSize, bool useLinks);
+
+	// empty when an input can't be read, restore and store do nothing for an empty key
+	std::string key(const std::string &filename, const Options &options);
+	// outputs are either outfile, or start with filename (like the .mesh.json and .anim.json files), so they can be restored for a different input path
+	bool restore(const std::string &key, const std::string &filename, const std::string &outfile);
+	void store(const std::string &key, const std::string &filename, const std::string &outfile, const std::vector<std::string> &outputs);
+};
+
+std::vector<std::string> sideFiles(const std::string &filename);
+std::string inputHash(const std::string &filename, const std::string &salt);
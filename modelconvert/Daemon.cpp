@@ -0,0 +1,359 @@
+#include <string>
+#include <vector>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+#include <blib/json.h>
+
+#include "ModelConvert.h"
+#include "SceneImport.h"
+#include "Cache.h"
+#include "Progress.h"
+#include "Logger.h"
+
+// The daemon sets up once, then forks workers that all accept connections on the same unix socket. A client sends one
+// json line with the input, the output and the conversion options as they are given on the command line, and gets one
+// json line back with the result and timings. The workers inherit the warm importers from the daemon, and a worker that
+// crashes only loses the conversion it was doing, the daemon starts a new one
+
+#ifdef _WIN32
+
+int runDaemon(const std::string &socketPath, const Options &options)
+{
+	LOG(Error) << "The daemon needs unix sockets, which are not supported on Windows";
+	return -1;
+}
+
+int sendToDaemon(const std::string &socketPath, const std::string &filename, const std::string &outfile, const std::vector<std::string> &optionArgs)
+{
+	LOG(Error) << "The daemon needs unix sockets, which are not supported on Windows";
+	return -1;
+}
+
+#else
+
+static const int requestsPerWorker = 1000; // workers are replaced now and then, so memory the converters leak does not pile up
+static const int requestTimeout = 10; // seconds a client gets to send its request, so a stuck client does not hold on to a worker
+static const size_t maxLineLength = 1024 * 1024;
+
+static bool writeAll(int fd, const std::string &data)
+{
+	size_t written = 0;
+	while (written < data.size())
+	{
+		ssize_t len = write(fd, data.c_str() + written, data.size() - written);
+		if (len <= 0)
+			return false;
+		written += len;
+	}
+	return true;
+}
+
+static bool readLine(int fd, std::string &line)
+{
+	line.clear();
+	char buf[4096];
+	while (line.find('\n') == std::string::npos)
+	{
+		if (line.size() > maxLineLength)
+			return false;
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return false;
+		line.append(buf, len);
+	}
+	line.erase(line.find('\n'));
+	return true;
+}
+
+static bool socketAddress(const std::string &socketPath, struct sockaddr_un &address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path))
+	{
+		LOG(Error) << "Socket path " << socketPath << " is too long";
+		return false;
+	}
+	strcpy(address.sun_path, socketPath.c_str());
+	return true;
+}
+
+static float secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+static blib::json::Value handleRequest(const blib::json::Value &request, const Options &defaults)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	blib::json::Value response(blib::json::Type::objectValue);
+	response["success"] = false;
+	if (!request.isObject() || !request.isMember("input"))
+	{
+		response["error"] = "Invalid request";
+		return response;
+	}
+
+	Options options = defaults;
+	std::vector<std::string> args;
+	if (request.isMember("options"))
+		for (size_t i = 0; i < request["options"].size(); i++)
+			args.push_back(request["options"][(int)i].asString());
+	for (size_t i = 0; i < args.size(); i++)
+	{
+		std::string error;
+		if (!conversionOption(args, i, options, error))
+			error = "The daemon does not support the option " + args[i];
+		if (!error.empty())
+		{
+			response["error"] = error;
+			return response;
+		}
+	}
+
+	std::string filename = request["input"].asString();
+	std::string outfile = filename + ".json";
+	if (request.isMember("output") && !request["output"].asString().empty())
+		outfile = request["output"].asString();
+	LOG(Info) << "Converting " << filename;
+
+	ConversionCache* cache = NULL;
+	std::string cacheKey;
+	if (!options.cacheDirectory.empty())
+	{
+		cache = new ConversionCache(options.cacheDirectory, options.cacheSize * 1024LL * 1024LL, options.cacheLinks);
+		cacheKey = cache->key(filename, options);
+	}
+
+	std::vector<std::string> outputFiles;
+	bool cached = cache && cache->restore(cacheKey, filename, outfile);
+	float convertTime = 0;
+	float writeTime = 0;
+	if (cached)
+		outputFiles.push_back(outfile);
+	else
+	{
+		blib::json::Value data = convertModel(filename, options, outputFiles);
+		convertTime = secondsSince(start);
+		if (!data.isNull())
+		{
+			writeModel(data, outfile);
+			outputFiles.push_back(outfile);
+		}
+		writeTime = secondsSince(start) - convertTime;
+		if (cache && !outputFiles.empty())
+			cache->store(cacheKey, filename, outfile, outputFiles);
+	}
+	delete cache;
+
+	response["success"] = !outputFiles.empty();
+	if (outputFiles.empty())
+		response["error"] = progress.isCancelled() ? "Cancelled, the conversion passed its deadline" : "Could not convert " + filename;
+	response["cached"] = cached;
+	response["outputs"] = blib::json::Value(blib::json::Type::arrayValue);
+	for (size_t i = 0; i < outputFiles.size(); i++)
+		response["outputs"].push_back(outputFiles[i]);
+	response["time"]["convert"] = convertTime;
+	response["time"]["write"] = writeTime;
+	response["time"]["total"] = secondsSince(start);
+	return response;
+}
+
+static void runWorker(int listener, const Options &options)
+{
+	signal(SIGPIPE, SIG_IGN); // a client that went away should not stop the worker
+	int handled = 0;
+	while (handled < requestsPerWorker)
+	{
+		int client = accept(listener, NULL, NULL);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		struct timeval timeout;
+		timeout.tv_sec = requestTimeout;
+		timeout.tv_usec = 0;
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		std::string line;
+		if (readLine(client, line))
+		{
+			std::ostringstream response;
+			response << handleRequest(blib::json::readJson(line), options);
+			writeAll(client, response.str() + "\n");
+			handled++;
+		}
+		close(client);
+		logger.flush();
+		fflush(stdout);
+	}
+	logger.flush();
+	fflush(stdout);
+	_exit(0);
+}
+
+
+//a socket left behind by a daemon that did not shut down is removed, anything else at the path is left alone
+static bool removeStaleSocket(const std::string &socketPath, const struct sockaddr_un &address)
+{
+	struct stat info;
+	if (lstat(socketPath.c_str(), &info) != 0)
+		return errno == ENOENT;
+	if (!S_ISSOCK(info.st_mode))
+	{
+		LOG(Error) << socketPath << " exists and is not a socket";
+		return false;
+	}
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe < 0)
+		return false;
+	bool listening = connect(probe, (const struct sockaddr*)&address, sizeof(address)) == 0;
+	close(probe);
+	if (listening)
+	{
+		LOG(Error) << "A daemon is already listening on " << socketPath;
+		return false;
+	}
+	return unlink(socketPath.c_str()) == 0;
+}
+
+int runDaemon(const std::string &socketPath, const Options &options)
+{
+	struct sockaddr_un address;
+	if (!socketAddress(socketPath, address) || !removeStaleSocket(socketPath, address))
+		return -1;
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 128) != 0)
+	{
+		LOG(Error) << "Could not listen on " << socketPath << ": " << strerror(errno);
+		return -1;
+	}
+
+	//everything the workers share is set up before forking them
+	SceneImport::warmUp();
+	size_t workerCount = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+	LOG(Info) << "Listening on " << socketPath << " with " << (int)workerCount << " workers";
+
+	std::vector<pid_t> workers;
+	while (true)
+	{
+		while (workers.size() < workerCount)
+		{
+			logger.flush(); // or the worker prints what is still buffered again
+			fflush(stdout);
+			pid_t pid = fork();
+			if (pid == 0)
+				runWorker(listener, options);
+			if (pid < 0)
+			{
+				LOG(Error) << "Could not start a worker: " << strerror(errno);
+				break;
+			}
+			workers.push_back(pid);
+		}
+		if (workers.empty())
+		{
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if (pid == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		workers.erase(std::remove(workers.begin(), workers.end(), pid), workers.end());
+		if (WIFSIGNALED(status))
+			LOG(Warning) << "Worker " << (int)pid << " stopped with signal " << WTERMSIG(status) << ", starting a new one";
+	}
+	close(listener);
+	return 0;
+}
+
+
+//the daemon has its own working directory, so relative paths are made absolute
+static std::string absolutePath(const std::string &path)
+{
+	if (path.empty() || path[0] == '/')
+		return path;
+	char buf[4096];
+	if (!getcwd(buf, sizeof(buf)))
+		return path;
+	return std::string(buf) + "/" + path;
+}
+
+int sendToDaemon(const std::string &socketPath, const std::string &filename, const std::string &outfile, const std::vector<std::string> &optionArgs)
+{
+	if (outfile == "-")
+	{
+		LOG(Error) << "A daemon can not write the model to the console";
+		return -1;
+	}
+	struct sockaddr_un address;
+	if (!socketAddress(socketPath, address))
+		return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		LOG(Error) << "Could not connect to the daemon on " << socketPath << ": " << strerror(errno);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	blib::json::Value request(blib::json::Type::objectValue);
+	request["input"] = absolutePath(filename);
+	request["output"] = absolutePath(outfile);
+	request["options"] = blib::json::Value(blib::json::Type::arrayValue);
+	for (size_t i = 0; i < optionArgs.size(); i++)
+		request["options"].push_back(optionArgs[i]);
+	std::ostringstream message;
+	message << request;
+
+	std::string line;
+	bool answered = writeAll(fd, message.str() + "\n") && readLine(fd, line);
+	close(fd);
+	if (!answered)
+	{
+		LOG(Error) << "The daemon did not answer, the conversion of " << filename << " may have crashed it";
+		return -1;
+	}
+
+	blib::json::Value response = blib::json::readJson(line);
+	if (!response.isObject() || !response["success"].asBool())
+	{
+		LOG(Error) << "Could not convert " << filename << ": " << (response.isObject() ? response["error"].asString() : "invalid answer");
+		return -1;
+	}
+	for (size_t i = 0; i < response["outputs"].size(); i++)
+		printf("Wrote %s\n", response["outputs"][(int)i].asString().c_str());
+	printf("Converted %s in %.3fs%s (convert %.3fs, write %.3fs)\n", filename.c_str(), response["time"]["total"].asFloat(),
+		response["cached"].asBool() ? " from the cache" : "", response["time"]["convert"].asFloat(), response["time"]["write"].asFloat());
+	return 0;
+}
+
+#endif
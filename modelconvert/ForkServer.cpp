@@ -0,0 +1,302 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
+
+#include <blib/json.h>
+
+#include "ModelConvert.h"
+#include "Cache.h"
+#include "Logger.h"
+
+// Isolated batches fork a worker from the already started converter for every file, instead of starting a new
+// converter. The worker converts the file and sends the result back over a pipe: a json line with the files the
+// converter wrote itself and the length of the model, followed by the pretty printed model. The files the converter
+// writes itself, like the .anim files, get a temporary name in the worker. The parent writes the model, renames the
+// other files and keeps the cache, so a worker that crashes, hangs or runs out of memory never leaves half a result behind
+
+#ifdef _WIN32
+
+//windows has no fork, separate processes give the same isolation, at the cost of starting the converter for every file
+int isolatedBatch(const std::vector<std::string> &command, const std::vector<std::string> &files, const Options &options)
+{
+	LOG(Info) << "Isolated conversions run as separate processes on Windows";
+	return scheduleBatch(command, files, options);
+}
+
+#else
+
+struct Worker
+{
+	pid_t pid;
+	int pipe;
+	std::string filename;
+	std::string outfile;
+	std::string cacheKey;
+	std::string received;
+	std::chrono::steady_clock::time_point deadline;
+	bool timedOut;
+};
+
+static bool writeAll(int fd, const std::string &data)
+{
+	size_t written = 0;
+	while (written < data.size())
+	{
+		ssize_t len = write(fd, data.c_str() + written, data.size() - written);
+		if (len <= 0)
+			return false;
+		written += len;
+	}
+	return true;
+}
+
+//the suffix of the files a worker writes before the parent renames them
+static std::string workerSuffix(pid_t pid)
+{
+	return "." + std::to_string((long long)pid) + ".part";
+}
+
+//removes the files a failed worker left behind. They start with the name of the model, and end with the suffix
+static void removeWorkerFiles(const Worker &worker)
+{
+	size_t slash = worker.filename.rfind('/');
+	std::string directory = slash == std::string::npos ? "." : worker.filename.substr(0, slash);
+	std::string name = worker.filename.substr(slash == std::string::npos ? 0 : slash + 1);
+	std::string suffix = workerSuffix(worker.pid);
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return;
+	while (struct dirent* entry = readdir(dir))
+	{
+		std::string file = entry->d_name;
+		if (file.size() > name.size() + suffix.size() && file.compare(0, name.size(), name) == 0 &&
+			file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0)
+			remove((directory + "/" + file).c_str());
+	}
+	closedir(dir);
+}
+
+static void runWorker(const std::string &filename, Options options, int fd)
+{
+	options.outputSuffix = workerSuffix(getpid());
+	if (options.jobMemory > 0)
+	{
+		struct rlimit limit;
+		limit.rlim_cur = limit.rlim_max = options.jobMemory * 1024ULL * 1024ULL;
+		setrlimit(RLIMIT_AS, &limit);
+	}
+
+	std::vector<std::string> outputFiles;
+	blib::json::Value data = convertModel(filename, options, outputFiles);
+	std::ostringstream model;
+	if (!data.isNull())
+		writeModel(data, model);
+
+	blib::json::Value header(blib::json::Type::objectValue);
+	header["outputs"] = blib::json::Value(blib::json::Type::arrayValue);
+	for (size_t i = 0; i < outputFiles.size(); i++)
+		header["outputs"].push_back(outputFiles[i]);
+	header["converted"] = !data.isNull() || !outputFiles.empty();
+	header["model"] = std::to_string(model.str().size()); // as a string, an int can't hold the size of a large model
+	std::ostringstream message;
+	message << header;
+	logger.flush();
+	fflush(stdout);
+	_exit(writeAll(fd, message.str() + "\n" + model.str()) ? 0 : 1);
+}
+
+static bool startWorker(Worker &worker, const std::vector<Worker> &workers, const Options &options)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	logger.flush(); // or the worker prints what is still buffered again
+	fflush(stdout);
+	worker.pid = fork();
+	if (worker.pid == 0)
+	{
+		close(fds[0]);
+		for (size_t i = 0; i < workers.size(); i++)
+			close(workers[i].pipe);
+		runWorker(worker.filename, options, fds[1]);
+	}
+	close(fds[1]);
+	if (worker.pid < 0)
+	{
+		close(fds[0]);
+		return false;
+	}
+	worker.pipe = fds[0];
+	worker.timedOut = false;
+	worker.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options.jobTimeout > 0 ? options.jobTimeout : 0);
+	return true;
+}
+
+//collects the worker after its pipe closed, and writes its result. Returns false when the conversion failed
+static bool finishWorker(Worker &worker, ConversionCache* cache, const Options &options)
+{
+	close(worker.pipe);
+	int status = 0;
+	while (waitpid(worker.pid, &status, 0) == -1 && errno == EINTR)
+		;
+
+	size_t newline = worker.received.find('\n');
+	blib::json::Value header;
+	if (newline != std::string::npos)
+		header = blib::json::readJson(worker.received.substr(0, newline));
+	bool complete = WIFEXITED(status) && WEXITSTATUS(status) == 0 && header.isObject() &&
+		worker.received.size() - newline - 1 == strtoull(header["model"].asString().c_str(), NULL, 10);
+	if (!complete || !header["converted"].asBool())
+		removeWorkerFiles(worker);
+
+	if (worker.timedOut)
+	{
+		LOG(Error) << "Conversion of " << worker.filename << " took longer than " << options.jobTimeout << " seconds and was stopped";
+		return false;
+	}
+	if (WIFSIGNALED(status))
+	{
+		LOG(Error) << "Conversion of " << worker.filename << " crashed with signal " << WTERMSIG(status) << (options.jobMemory > 0 ? ", it may have run out of memory" : "");
+		return false;
+	}
+
+	if (!complete)
+	{
+		LOG(Error) << "Conversion of " << worker.filename << " did not send back a result";
+		return false;
+	}
+	if (!header["converted"].asBool())
+	{
+		LOG(Error) << "Could not convert " << worker.filename;
+		return false;
+	}
+
+	std::vector<std::string> outputFiles;
+	for (size_t i = 0; i < header["outputs"].size(); i++)
+	{
+		std::string output = header["outputs"][(int)i].asString();
+		if (rename((output + workerSuffix(worker.pid)).c_str(), output.c_str()) != 0)
+		{
+			LOG(Error) << "Could not move " << output << " into place";
+			removeWorkerFiles(worker);
+			return false;
+		}
+		outputFiles.push_back(output);
+	}
+	size_t modelSize = worker.received.size() - newline - 1;
+	if (modelSize > 0)
+	{
+		std::ofstream out(worker.outfile.c_str(), std::ios_base::binary | std::ios_base::out);
+		out.write(worker.received.c_str() + newline + 1, modelSize);
+		outputFiles.push_back(worker.outfile);
+		LOG(Info) << "Wrote " << worker.outfile;
+	}
+	if (cache && !outputFiles.empty())
+		cache->store(worker.cacheKey, worker.filename, worker.outfile, outputFiles);
+	return true;
+}
+
+
+//workers are forked from this process, so the command that starts a converter is only used on windows
+int isolatedBatch(const std::vector<std::string> & /*command*/, const std::vector<std::string> &files, const Options &options)
+{
+	ConversionCache* cache = NULL;
+	if (!options.cacheDirectory.empty())
+		cache = new ConversionCache(options.cacheDirectory, options.cacheSize * 1024LL * 1024LL, options.cacheLinks);
+	size_t maxWorkers = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<Worker> workers;
+	size_t next = 0;
+	int failed = 0;
+	while (next < files.size() || !workers.empty())
+	{
+		while (workers.size() < maxWorkers && next < files.size())
+		{
+			Worker worker;
+			worker.filename = files[next++];
+			worker.outfile = worker.filename + ".json";
+			if (cache)
+			{
+				worker.cacheKey = cache->key(worker.filename, options);
+				if (cache->restore(worker.cacheKey, worker.filename, worker.outfile))
+					continue;
+			}
+			LOG(Info) << "Converting " << worker.filename;
+			if (!startWorker(worker, workers, options))
+			{
+				LOG(Error) << "Could not start a conversion of " << worker.filename;
+				failed++;
+				continue;
+			}
+			workers.push_back(worker);
+		}
+		if (workers.empty())
+			continue;
+
+		//wait for output from a worker, or the first deadline
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		int timeout = -1;
+		std::vector<struct pollfd> fds(workers.size());
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			fds[i].fd = workers[i].pipe;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+			if (options.jobTimeout > 0 && !workers[i].timedOut)
+			{
+				int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(workers[i].deadline - now).count();
+				timeout = timeout == -1 ? std::max(0, left) : std::min(timeout, std::max(0, left));
+			}
+		}
+		poll(&fds[0], fds.size(), timeout);
+
+		now = std::chrono::steady_clock::now();
+		for (size_t i = workers.size(); i-- > 0; )
+		{
+			if (fds[i].revents != 0)
+			{
+				char buf[65536];
+				ssize_t len = read(workers[i].pipe, buf, sizeof(buf));
+				if (len > 0)
+					workers[i].received.append(buf, len);
+				else if (len < 0 && (errno == EINTR || errno == EAGAIN))
+					continue; // nothing read this time, polled again
+				else
+				{
+					if (!finishWorker(workers[i], cache, options))
+						failed++;
+					workers.erase(workers.begin() + i);
+					continue;
+				}
+			}
+			if (options.jobTimeout > 0 && !workers[i].timedOut && now >= workers[i].deadline)
+			{
+				kill(workers[i].pid, SIGKILL);
+				workers[i].timedOut = true; // its pipe closes now, and it is collected with the other finished workers
+			}
+		}
+	}
+	delete cache;
+
+	printf("Converted %i of %i models\n", (int)files.size() - failed, (int)files.size());
+	return failed > 0 ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,169 @@
+#include <string>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include <blib/util/FileSystem.h>
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include "ModelConvert.h"
+#include "Logger.h"
+
+struct ImportProfile
+{
+	const char* name;
+	unsigned int flags;
+	const char* description;
+};
+
+static const ImportProfile profiles[] =
+{
+	{ "production", aiProcessPreset_TargetRealtime_Quality | aiProcess_OptimizeMeshes | aiProcess_RemoveRedundantMaterials | aiProcess_OptimizeGraph,
+		"full optimization, the default" },
+	{ "fast-preview", aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_GenNormals | aiProcess_LimitBoneWeights,
+		"only what the converter needs, for a quick look at a model" },
+	// OptimizeGraph collapses nodes the skeleton output refers to, and merged meshes are split again when they use too many bones
+	{ "skinned", aiProcessPreset_TargetRealtime_Quality | aiProcess_OptimizeMeshes | aiProcess_RemoveRedundantMaterials | aiProcess_SplitByBoneCount,
+		"keeps the node hierarchy intact for skinned and animated models" },
+};
+
+// all post processing steps, in the order assimp runs them
+struct ImportStep
+{
+	unsigned int flag;
+	const char* name;
+};
+
+static const ImportStep steps[] =
+{
+	{ aiProcess_ValidateDataStructure, "ValidateDataStructure" },
+	{ aiProcess_RemoveComponent, "RemoveComponent" },
+	{ aiProcess_RemoveRedundantMaterials, "RemoveRedundantMaterials" },
+	{ aiProcess_FindInstances, "FindInstances" },
+	{ aiProcess_OptimizeGraph, "OptimizeGraph" },
+	{ aiProcess_OptimizeMeshes, "OptimizeMeshes" },
+	{ aiProcess_FindDegenerates, "FindDegenerates" },
+	{ aiProcess_GenUVCoords, "GenUVCoords" },
+	{ aiProcess_TransformUVCoords, "TransformUVCoords" },
+	{ aiProcess_PreTransformVertices, "PreTransformVertices" },
+	{ aiProcess_Triangulate, "Triangulate" },
+	{ aiProcess_SortByPType, "SortByPType" },
+	{ aiProcess_FindInvalidData, "FindInvalidData" },
+	{ aiProcess_FixInfacingNormals, "FixInfacingNormals" },
+	{ aiProcess_SplitByBoneCount, "SplitByBoneCount" },
+	{ aiProcess_GenNormals, "GenNormals" },
+	{ aiProcess_GenSmoothNormals, "GenSmoothNormals" },
+	{ aiProcess_CalcTangentSpace, "CalcTangentSpace" },
+	{ aiProcess_JoinIdenticalVertices, "JoinIdenticalVertices" },
+	{ aiProcess_SplitLargeMeshes, "SplitLargeMeshes" },
+	{ aiProcess_MakeLeftHanded, "MakeLeftHanded" },
+	{ aiProcess_FlipUVs, "FlipUVs" },
+	{ aiProcess_FlipWindingOrder, "FlipWindingOrder" },
+	{ aiProcess_Debone, "Debone" },
+	{ aiProcess_LimitBoneWeights, "LimitBoneWeights" },
+	{ aiProcess_ImproveCacheLocality, "ImproveCacheLocality" },
+};
+
+
+bool importProfile(const std::string &name, unsigned int &flags)
+{
+	for (size_t i = 0; i < sizeof(profiles) / sizeof(ImportProfile); i++)
+	{
+		if (name == profiles[i].name)
+		{
+			flags = profiles[i].flags;
+			return true;
+		}
+	}
+	return false;
+}
+
+void printImportProfiles()
+{
+	for (size_t i = 0; i < sizeof(profiles) / sizeof(ImportProfile); i++)
+		printf("                     %-13s %s\n", profiles[i].name, profiles[i].description);
+}
+
+
+static double millisecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void countScene(const aiScene* scene, long long &vertices, long long &faces)
+{
+	vertices = 0;
+	faces = 0;
+	if (!scene)
+		return;
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+	{
+		vertices += scene->mMeshes[i]->mNumVertices;
+		faces += scene->mMeshes[i]->mNumFaces;
+	}
+}
+
+//imports without post processing, then runs the steps of the import flags one at a time, timing each of them
+bool profileImportSteps(const std::string &filename, const Options &options)
+{
+	blib::util::FileSystem::registerHandler(new blib::util::PhysicalFileSystemHandler(""));
+	char* data;
+	int len = blib::util::FileSystem::getData(filename, data);
+	if (len == 0)
+	{
+		LOG(Error) << "Error opening file " << filename;
+		return false;
+	}
+	std::string hint = fileExtension(filename);
+
+	Assimp::Importer importer;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	const aiScene* scene = importer.ReadFileFromMemory(data, len, 0, hint.c_str());
+	if (!scene)
+	{
+		LOG(Error) << "Could not import " << filename << ": " << importer.GetErrorString();
+		delete[] data;
+		return false;
+	}
+	double importTime = millisecondsSince(start);
+
+	long long vertices, faces;
+	countScene(scene, vertices, faces);
+	printf("%-26s %10s %12s %10s %12s %10s\n", "step", "ms", "vertices", "change", "faces", "change");
+	printf("%-26s %10.2f %12lld %10s %12lld %10s\n", "import", importTime, vertices, "", faces, "");
+
+	double stepsTime = 0;
+	for (size_t i = 0; i < sizeof(steps) / sizeof(ImportStep); i++)
+	{
+		if ((options.importFlags & steps[i].flag) == 0)
+			continue;
+		start = std::chrono::high_resolution_clock::now();
+		scene = importer.ApplyPostProcessing(steps[i].flag);
+		double time = millisecondsSince(start);
+		stepsTime += time;
+		if (!scene)
+		{
+			LOG(Error) << steps[i].name << " failed: " << importer.GetErrorString();
+			delete[] data;
+			return false;
+		}
+
+		long long newVertices, newFaces;
+		countScene(scene, newVertices, newFaces);
+		printf("%-26s %10.2f %12lld %+10lld %12lld %+10lld\n", steps[i].name, time, newVertices, newVertices - vertices, newFaces, newFaces - faces);
+		vertices = newVertices;
+		faces = newFaces;
+	}
+	printf("%-26s %10.2f\n", "total", importTime + stepsTime);
+
+	//steps share work when they run together (the spatial sort for normals and joining vertices), so time the normal import as well
+	Assimp::Importer combined;
+	start = std::chrono::high_resolution_clock::now();
+	if (combined.ReadFileFromMemory(data, len, options.importFlags, hint.c_str()))
+		printf("%-26s %10.2f\n", "all steps at once", millisecondsSince(start));
+	delete[] data;
+	return true;
+}
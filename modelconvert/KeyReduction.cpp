@@ -0,0 +1,253 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+#include <assimp/scene.h>
+
+#include "ModelConvert.h"
+#include "Logger.h"
+
+aiVector3D sampleKeys(const aiVectorKey* keys, unsigned int count, double time);
+aiQuaternion sampleKeys(const aiQuatKey* keys, unsigned int count, double time);
+
+
+struct ReductionBone
+{
+	const aiNodeAnim* channel;
+	float reach;		// distance to the farthest joint below this bone, errors are measured this far away from the joint
+	int chainLength;	// number of animated bones on the longest root-to-leaf chain going through this bone
+};
+
+struct TrackSample
+{
+	aiMatrix4x4 parent;	// world transformation of the parent node at the key time
+	aiVector3D position;
+	aiQuaternion rotation;
+	aiVector3D scale;
+};
+
+
+static aiMatrix4x4 localTransform(const aiNode* node, const std::map<const aiNode*, ReductionBone> &bones, double time)
+{
+	std::map<const aiNode*, ReductionBone>::const_iterator it = bones.find(node);
+	if (it == bones.end() || !it->second.channel)
+		return node->mTransformation;
+	const aiNodeAnim* channel = it->second.channel;
+
+	aiVector3D position, scale;
+	aiQuaternion rotation;
+	node->mTransformation.Decompose(scale, rotation, position);
+	if (channel->mNumPositionKeys > 0)
+		position = sampleKeys(channel->mPositionKeys, channel->mNumPositionKeys, time);
+	if (channel->mNumRotationKeys > 0)
+		rotation = sampleKeys(channel->mRotationKeys, channel->mNumRotationKeys, time);
+	if (channel->mNumScalingKeys > 0)
+		scale = sampleKeys(channel->mScalingKeys, channel->mNumScalingKeys, time);
+	return aiMatrix4x4(scale, rotation, position);
+}
+
+static aiMatrix4x4 worldTransform(const aiNode* node, const std::map<const aiNode*, ReductionBone> &bones, double time)
+{
+	aiMatrix4x4 ret;
+	for (; node; node = node->mParent)
+		ret = localTransform(node, bones, time) * ret;
+	return ret;
+}
+
+//largest distance from node to any joint below it, in the node's own space
+static float measureReach(const aiNode* node, const aiMatrix4x4& transform)
+{
+	float reach = 0;
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+	{
+		aiMatrix4x4 childTransform = transform * node->mChildren[i]->mTransformation;
+		reach = std::max(reach, aiVector3D(childTransform.a4, childTransform.b4, childTransform.c4).Length());
+		reach = std::max(reach, measureReach(node->mChildren[i], childTransform));
+	}
+	return reach;
+}
+
+//fills in bones for node and everything below it, returns the number of animated bones on the longest chain below node
+static int collectBones(const aiNode* node, int animatedAbove, const aiAnimation* animation, std::map<const aiNode*, ReductionBone> &bones)
+{
+	ReductionBone& bone = bones[node];
+	bone.channel = NULL;
+	for (unsigned int i = 0; i < animation->mNumChannels && !bone.channel; i++)
+		if (animation->mChannels[i]->mNodeName == node->mName)
+			bone.channel = animation->mChannels[i];
+
+	bone.reach = measureReach(node, aiMatrix4x4());
+	if (bone.reach == 0) //leaf bones get the length of the bone that leads to them
+		bone.reach = aiVector3D(node->mTransformation.a4, node->mTransformation.b4, node->mTransformation.c4).Length();
+
+	int animated = bone.channel ? 1 : 0;
+	int below = 0;
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+		below = std::max(below, collectBones(node->mChildren[i], animatedAbove + animated, animation, bones));
+	bones[node].chainLength = animatedAbove + animated + below;
+	return animated + below;
+}
+
+//world space distance that points around the joint move when using approx instead of exact
+static float transformError(const TrackSample& sample, const aiMatrix4x4& exact, const aiMatrix4x4& approx, float reach)
+{
+	static const aiVector3D directions[] = { aiVector3D(0, 0, 0), aiVector3D(1, 0, 0), aiVector3D(-1, 0, 0), aiVector3D(0, 1, 0), aiVector3D(0, -1, 0), aiVector3D(0, 0, 1), aiVector3D(0, 0, -1) };
+	aiMatrix4x4 exactWorld = sample.parent * exact;
+	aiMatrix4x4 approxWorld = sample.parent * approx;
+	float error = 0;
+	for (int i = 0; i < 7; i++)
+		error = std::max(error, (exactWorld * (directions[i] * reach) - approxWorld * (directions[i] * reach)).Length());
+	return error;
+}
+
+static float keyFactor(double a, double b, double time)
+{
+	return b > a ? (float)((time - a) / (b - a)) : 0.0f;
+}
+
+static aiVector3D interpolateKey(const aiVectorKey& a, const aiVectorKey& b, double time)
+{
+	return a.mValue + (b.mValue - a.mValue) * keyFactor(a.mTime, b.mTime, time);
+}
+
+static aiQuaternion interpolateKey(const aiQuatKey& a, const aiQuatKey& b, double time)
+{
+	aiQuaternion ret;
+	aiQuaternion::Interpolate(ret, a.mValue, b.mValue, keyFactor(a.mTime, b.mTime, time));
+	return ret.Normalize();
+}
+
+//Douglas-Peucker style reduction: starting with the first and last key, the key that interpolating between the kept
+//keys around it gets most wrong is kept, and both halves are split again, until every key is within tolerance. Every
+//pass over a segment checks its keys once, so this is O(n log n) for most tracks. Returns the new key count
+template<class Key, class ErrorFunc>
+static unsigned int reduceKeys(Key* keys, unsigned int count, float tolerance, ErrorFunc error)
+{
+	if (count < 2)
+		return count;
+
+	std::vector<bool> keep(count, false);
+	keep[0] = keep[count - 1] = true;
+	std::vector<std::pair<unsigned int, unsigned int> > segments(1, std::make_pair(0u, count - 1));
+	while (!segments.empty())
+	{
+		unsigned int start = segments.back().first;
+		unsigned int end = segments.back().second;
+		segments.pop_back();
+		float worst = tolerance;
+		unsigned int split = 0;
+		for (unsigned int i = start + 1; i < end; i++)
+		{
+			float e = error(i, interpolateKey(keys[start], keys[end], keys[i].mTime));
+			if (e > worst)
+			{
+				worst = e;
+				split = i;
+			}
+		}
+		if (split == 0)
+			continue;
+		keep[split] = true;
+		segments.push_back(std::make_pair(start, split));
+		segments.push_back(std::make_pair(split, end));
+	}
+
+	std::vector<Key> kept;
+	for (unsigned int i = 0; i < count; i++)
+		if (keep[i])
+			kept.push_back(keys[i]);
+
+	//constant tracks only need a single key. Every key is compared with the first, a track that moves away and comes
+	//back to where it started is not constant
+	bool constant = true;
+	for (unsigned int i = 1; i < count && constant; i++)
+		constant = error(i, keys[0].mValue) <= tolerance;
+	if (constant)
+		kept.resize(1);
+
+	std::copy(kept.begin(), kept.end(), keys);
+	return (unsigned int)kept.size();
+}
+
+static std::vector<TrackSample> sampleTrack(const aiNode* node, const std::map<const aiNode*, ReductionBone> &bones, const std::vector<double> &times)
+{
+	std::vector<TrackSample> samples(times.size());
+	for (size_t i = 0; i < times.size(); i++)
+	{
+		samples[i].parent = node->mParent ? worldTransform(node->mParent, bones, times[i]) : aiMatrix4x4();
+		localTransform(node, bones, times[i]).Decompose(samples[i].scale, samples[i].rotation, samples[i].position);
+	}
+	return samples;
+}
+
+template<class Key>
+static std::vector<double> keyTimes(const Key* keys, unsigned int count)
+{
+	std::vector<double> times(count);
+	for (unsigned int i = 0; i < count; i++)
+		times[i] = keys[i].mTime;
+	return times;
+}
+
+
+void reduceAnimation(const aiScene* scene, aiAnimation* animation, const Options &options)
+{
+	std::map<const aiNode*, ReductionBone> bones;
+	collectBones(scene->mRootNode, 0, animation, bones);
+
+	int keysBefore = 0;
+	int keysAfter = 0;
+	for (unsigned int i = 0; i < animation->mNumChannels; i++)
+	{
+		aiNodeAnim* channel = animation->mChannels[i];
+		keysBefore += channel->mNumPositionKeys + channel->mNumRotationKeys + channel->mNumScalingKeys;
+
+		const aiNode* node = scene->mRootNode->FindNode(channel->mNodeName);
+		if (!node)
+		{
+			keysAfter += channel->mNumPositionKeys + channel->mNumRotationKeys + channel->mNumScalingKeys;
+			continue;
+		}
+		const ReductionBone& bone = bones[node];
+
+		//every bone on a chain gets an equal share of the tolerance, so the errors of the spine and the arm together stay within bounds at the fingertips
+		float share = 1.0f / std::max(1, bone.chainLength);
+
+		if (options.reducePosition > 0)
+		{
+			std::vector<TrackSample> samples = sampleTrack(node, bones, keyTimes(channel->mPositionKeys, channel->mNumPositionKeys));
+			channel->mNumPositionKeys = reduceKeys(channel->mPositionKeys, channel->mNumPositionKeys, options.reducePosition * share, [&](unsigned int key, const aiVector3D& approx)
+			{
+				const TrackSample& s = samples[key];
+				return transformError(s, aiMatrix4x4(s.scale, s.rotation, s.position), aiMatrix4x4(s.scale, s.rotation, approx), bone.reach);
+			});
+		}
+		if (options.reduceRotation > 0)
+		{
+			std::vector<TrackSample> samples = sampleTrack(node, bones, keyTimes(channel->mRotationKeys, channel->mNumRotationKeys));
+			channel->mNumRotationKeys = reduceKeys(channel->mRotationKeys, channel->mNumRotationKeys, options.reduceRotation * share, [&](unsigned int key, const aiQuaternion& approx)
+			{
+				const TrackSample& s = samples[key];
+				return transformError(s, aiMatrix4x4(s.scale, s.rotation, s.position), aiMatrix4x4(s.scale, approx, s.position), bone.reach);
+			});
+		}
+		if (options.reduceScale > 0)
+		{
+			std::vector<TrackSample> samples = sampleTrack(node, bones, keyTimes(channel->mScalingKeys, channel->mNumScalingKeys));
+			channel->mNumScalingKeys = reduceKeys(channel->mScalingKeys, channel->mNumScalingKeys, options.reduceScale * share, [&](unsigned int key, const aiVector3D& approx)
+			{
+				const TrackSample& s = samples[key];
+				return transformError(s, aiMatrix4x4(s.scale, s.rotation, s.position), aiMatrix4x4(approx, s.rotation, s.position), bone.reach);
+			});
+		}
+
+		keysAfter += channel->mNumPositionKeys + channel->mNumRotationKeys + channel->mNumScalingKeys;
+	}
+
+	std::ostringstream ratio;
+	if (keysAfter > 0)
+		ratio << " (" << (float)keysBefore / keysAfter << ":1)";
+	LOG(Info) << "Animation " << animation->mName.C_Str() << ": reduced " << keysBefore << " keys to " << keysAfter << ratio.str();
+}
@@ -0,0 +1,230 @@
+#include <string>
+#include <thread>
+#include <mutex>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "Logger.h"
+
+// a bounded queue after Dmitry Vyukov's: every slot has a sequence number that tells writers and the reader whose turn
+// it is, so threads only contend on the position they claim
+static const size_t capacity = 4096;	// a power of two
+
+struct Slot
+{
+	std::atomic<size_t> sequence;
+	LogLevel level;
+	int thread;
+	double time;
+	std::string text;
+};
+
+static Slot slots[capacity];
+static std::atomic<size_t> tail(0);		// next slot to write to
+static std::atomic<size_t> head(0);		// next slot to read, only the writer thread moves it
+static std::atomic<long long> dropped(0);
+static std::atomic<LogSite*> sites(NULL);
+static std::atomic<int> writerPid(0);		// a forked process has to start a writer of its own
+static std::atomic<bool> stopping(false);
+static std::atomic<bool> running(false);
+static std::mutex startMutex;
+static std::atomic<int> threads(0);
+static thread_local int logThread = -1;
+
+static const char* levelNames[] = { "error", "warning", "info", "debug" };
+
+Logger logger; // after slots, its constructor numbers them
+
+
+LogSite::LogSite(const char* file, int line) : file(file), line(line), window(0), count(0), suppressed(0), totalSuppressed(0)
+{
+	next = sites;
+	while (!sites.compare_exchange_weak(next, this))
+		;
+}
+
+Logger::Logger() : level((int)LogLevel::Info), rateLimit(10), json(false), start(std::chrono::steady_clock::now())
+{
+	for (size_t i = 0; i < capacity; i++)
+		slots[i].sequence = i;
+}
+
+bool Logger::setLevel(const std::string &name)
+{
+	for (int i = 0; i < (int)(sizeof(levelNames) / sizeof(levelNames[0])); i++)
+	{
+		if (name == levelNames[i])
+		{
+			level = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+static std::string jsonString(const std::string &text)
+{
+	std::string ret = "\"";
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		char c = text[i];
+		if (c == '"' || c == '\\')
+			ret += std::string("\\") + c;
+		else if ((unsigned char)c < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			ret += buf;
+		}
+		else
+			ret += c;
+	}
+	return ret + "\"";
+}
+
+static void print(const Slot &slot, bool json)
+{
+	if (json)
+		printf("{\"time\":%.6f,\"level\":\"%s\",\"thread\":%i,\"message\":%s}\n", slot.time, levelNames[(int)slot.level], slot.thread, jsonString(slot.text).c_str());
+	else if (slot.level == LogLevel::Error)
+		printf("Error: %s\n", slot.text.c_str());
+	else if (slot.level == LogLevel::Warning)
+		printf("Warning: %s\n", slot.text.c_str());
+	else
+		printf("%s\n", slot.text.c_str());
+}
+
+//takes what is queued, returns false when the queue was empty
+static bool drain(bool json)
+{
+	bool any = false;
+	while (true)
+	{
+		size_t position = head;
+		Slot &slot = slots[position & (capacity - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+			break;
+		print(slot, json);
+		slot.text.clear();
+		slot.sequence.store(position + capacity, std::memory_order_release);
+		head = position + 1;
+		any = true;
+	}
+	if (any)
+		fflush(stdout);
+	return any;
+}
+
+static void startWriter()
+{
+	std::lock_guard<std::mutex> lock(startMutex);
+	if (writerPid == getpid())
+		return;
+	//a forked process inherits the queue, but what is in it belongs to the parent, which flushed before forking
+	head = tail.load();
+	writerPid = getpid();
+	running = true;
+	std::thread([]()
+	{
+		while (!stopping)
+			if (!drain(logger.isJson()))
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		drain(logger.isJson());
+		running = false;
+	}).detach();
+	static bool registered = false;
+	if (!registered)
+		atexit([]() { logger.stop(); });
+	registered = true;
+}
+
+
+void Logger::write(LogLevel level, LogSite &site, std::string message)
+{
+	double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	int limit = rateLimit;
+	if (limit > 0 && level != LogLevel::Error) // errors are never suppressed, they tell which files failed
+	{
+		long long second = (long long)time;
+		long long window = site.window;
+		if (second != window && site.window.compare_exchange_strong(window, second))
+			site.count = 0;
+		if (++site.count > limit)
+		{
+			site.suppressed++;
+			site.totalSuppressed++;
+			return;
+		}
+		int suppressed = site.suppressed.exchange(0);
+		if (suppressed > 0)
+			message += " (" + std::to_string(suppressed) + " more like this were suppressed)";
+	}
+
+	if (writerPid != getpid())
+		startWriter();
+	if (logThread == -1)
+		logThread = threads++;
+
+	size_t position = tail.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true)
+	{
+		slot = &slots[position & (capacity - 1)];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		if (sequence == position)
+		{
+			if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (sequence < position)
+		{
+			dropped++; // full, the writer can't keep up
+			return;
+		}
+		else
+			position = tail.load(std::memory_order_relaxed);
+	}
+	slot->level = level;
+	slot->thread = logThread;
+	slot->time = time;
+	slot->text = std::move(message);
+	slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+void Logger::flush()
+{
+	if (writerPid != getpid() || !running)
+		return;
+	size_t end = tail;
+	while (head < end && running)
+		std::this_thread::yield();
+	fflush(stdout);
+}
+
+void Logger::stop()
+{
+	if (writerPid != getpid() || !running)
+		return;
+	flush();
+	stopping = true;
+	while (running)
+		std::this_thread::yield();
+	stopping = false;
+	writerPid = 0;
+
+	for (LogSite* site = sites; site; site = site->next)
+		if (site->totalSuppressed > 0)
+			printf("%s:%i: %lld log messages suppressed\n", site->file, site->line, (long long)site->totalSuppressed);
+	if (dropped > 0)
+		printf("%lld log messages dropped, the log buffer was full\n", (long long)dropped);
+	fflush(stdout);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <chrono>
+
+// Messages of the converters go through a lock-free ring buffer that a background thread writes out, so logging from
+// worker threads or inside loops does not wait on the console. Messages below the level are not even formatted, and
+// every LOG statement below error is limited to a number of messages per second, the ones over the limit are counted
+// and reported later. When the buffer is full, messages are dropped and counted instead of blocking the converter
+
+enum class LogLevel
+{
+	Error,
+	Warning,
+	Info,
+	Debug,
+};
+
+// one LOG statement, keeps its own rate limit
+struct LogSite
+{
+	const char* file;
+	int line;
+	std::atomic<long long> window;		// second the count is for
+	std::atomic<int> count;
+	std::atomic<int> suppressed;		// since the last message that was written
+	std::atomic<long long> totalSuppressed;
+	LogSite* next;
+
+	LogSite(const char* file, int line);
+};
+
+class Logger
+{
+	std::atomic<int> level;
+	std::atomic<int> rateLimit;
+	std::atomic<bool> json;
+	std::chrono::steady_clock::time_point start;
+public:
+	Logger();
+
+	void setLevel(LogLevel level) { this->level = (int)level; }
+	bool setLevel(const std::string &name);
+	// messages per second per LOG statement, 0 for no limit
+	void setRateLimit(int messages) { rateLimit = messages; }
+	// writes every message as a json line with its time, level and thread
+	void setJson(bool json) { this->json = json; }
+	bool enabled(LogLevel level) const { return (int)level <= this->level; }
+	bool isJson() const { return json; }
+
+	void write(LogLevel level, LogSite &site, std::string message);
+	// waits until everything logged so far is written, call it before forking and before _exit
+	void flush();
+	// flushes, stops the writer and reports the messages that were suppressed or dropped
+	void stop();
+};
+
+extern Logger logger;
+
+class LogMessage
+{
+	LogLevel level;
+	LogSite &site;
+	std::ostringstream message;
+public:
+	LogMessage(LogLevel level, LogSite &site) : level(level), site(site) {}
+	~LogMessage() { logger.write(level, site, message.str()); }
+	std::ostream &stream() { return message; }
+};
+
+// turns the stream into a void expression, & binds weaker than <<, so it comes after the whole message
+struct LogVoidify
+{
+	void operator&(std::ostream&) {}
+};
+
+// LOG(Warning) << "text " << value; the message is only formatted when the level is enabled. It is an expression,
+// so it can stand under an if without braces
+#define LOG(level) \
+	!logger.enabled(LogLevel::level) ? (void)0 : \
+	LogVoidify() & LogMessage(LogLevel::level, []() -> LogSite& { static LogSite site(__FILE__, __LINE__); return site; }()).stream()
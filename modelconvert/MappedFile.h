@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// A file mapped read only into memory, so readers parse it straight from the page cache instead of copying it first.
+// data is NULL when the file could not be opened or is empty
+class MappedFile
+{
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+public:
+	const char* data;
+	size_t size;
+
+#ifdef _WIN32
+	MappedFile() : file(INVALID_HANDLE_VALUE), mapping(NULL), data(NULL), size(0) {}
+#else
+	MappedFile() : file(-1), data(NULL), size(0) {}
+#endif
+
+	void open(const std::string &filename)
+	{
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		LARGE_INTEGER fileSize;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			return;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+			return;
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = data ? (size_t)fileSize.QuadPart : 0;
+#else
+		file = ::open(filename.c_str(), O_RDONLY);
+		struct stat info;
+		if (file < 0 || fstat(file, &info) != 0 || info.st_size == 0)
+			return;
+		void* p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (p == MAP_FAILED)
+			return;
+		madvise(p, info.st_size, MADV_SEQUENTIAL);
+		data = (const char*)p;
+		size = info.st_size;
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (data)
+			munmap((void*)data, size);
+		if (file >= 0)
+			close(file);
+#endif
+	}
+};
@@ -0,0 +1,205 @@
+#include <new>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#define allocationSize _msize
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define allocationSize malloc_size
+#else
+#include <malloc.h>
+#define allocationSize malloc_usable_size
+#endif
+
+#include "MemoryStats.h"
+
+// Everything here can be used from operator new, before any constructor ran, so it only uses constant initialized
+// globals and never allocates itself. Sizes are what the allocator really handed out, so frees need no bookkeeping
+
+static const int maxStages = 256;
+
+struct StageStats
+{
+	const char* name;
+	std::atomic<long long> allocations;
+	std::atomic<long long> bytes;
+	std::atomic<long long> peak;	// highest heap size while the stage was active
+};
+
+std::atomic<bool> memoryStatsEnabled(false);
+static StageStats stages[maxStages];	// stage 0 is everything outside a stage
+static std::atomic<int> stageCount(1);
+static std::mutex stageMutex;
+static std::atomic<long long> heapSize(0);
+static std::atomic<long long> heapPeak(0);
+static long long heapBudget = 0;
+static thread_local int currentStage = 0;
+
+
+static void raise(std::atomic<long long> &value, long long newValue)
+{
+	long long old = value;
+	while (newValue > old && !value.compare_exchange_weak(old, newValue))
+		;
+}
+
+static void countAllocation(void* p)
+{
+	long long size = (long long)allocationSize(p);
+	long long heap = heapSize += size;
+	StageStats &stage = stages[currentStage];
+	stage.allocations++;
+	stage.bytes += size;
+	raise(stage.peak, heap);
+	raise(heapPeak, heap);
+}
+
+static void* allocate(size_t size)
+{
+	void* p = malloc(size > 0 ? size : 1);
+	if (p && memoryStatsEnabled)
+		countAllocation(p);
+	return p;
+}
+
+static void release(void* p)
+{
+	if (!p)
+		return;
+	if (memoryStatsEnabled)
+		heapSize -= (long long)allocationSize(p);
+	free(p);
+}
+
+
+void* operator new(size_t size)
+{
+	void* p = allocate(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	void* p = allocate(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+	return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+	return allocate(size);
+}
+
+void operator delete(void* p) throw()
+{
+	release(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+	release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+	release(p);
+}
+
+
+void enableMemoryStats(long long budget)
+{
+	stages[0].name = "(no stage)";
+	heapBudget = budget;
+	memoryStatsEnabled = true;
+}
+
+int enterMemoryStage(const char* name)
+{
+	int count = stageCount;
+	int index = 0;
+	for (int i = 1; i < count && index == 0; i++)
+		if (stages[i].name == name || strcmp(stages[i].name, name) == 0)
+			index = i;
+	if (index == 0)
+	{
+		std::lock_guard<std::mutex> lock(stageMutex);
+		count = stageCount;
+		for (int i = 1; i < count && index == 0; i++)
+			if (strcmp(stages[i].name, name) == 0)
+				index = i;
+		if (index == 0 && count < maxStages)
+		{
+			stages[count].name = name;
+			index = count;
+			stageCount = count + 1; // published after the name is set, the search above does not lock
+		}
+	}
+	int previous = currentStage;
+	currentStage = index;
+	return previous;
+}
+
+void leaveMemoryStage(int previous)
+{
+	currentStage = previous;
+}
+
+static void printSize(long long bytes)
+{
+	if (bytes >= 10 * 1024 * 1024)
+		printf(" %10lld MB", bytes / (1024 * 1024));
+	else
+		printf(" %10lld KB", bytes / 1024);
+}
+
+bool printMemoryStats()
+{
+	if (!memoryStatsEnabled)
+		return true;
+	memoryStatsEnabled = false;
+
+	std::vector<int> order;
+	for (int i = 0; i < stageCount; i++)
+		if (stages[i].allocations > 0)
+			order.push_back(i);
+	std::sort(order.begin(), order.end(), [](int a, int b) { return stages[a].bytes > stages[b].bytes; });
+
+	printf("%-30s %12s %13s %13s\n", "stage", "allocations", "allocated", "peak heap");
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const StageStats &stage = stages[order[i]];
+		printf("%-30s %12lld", stage.name, (long long)stage.allocations);
+		printSize(stage.bytes);
+		printSize(stage.peak);
+		printf("\n");
+	}
+	printf("%-30s %12s %13s", "total", "", "");
+	printSize(heapPeak);
+	printf("\n");
+
+	if (heapBudget > 0 && heapPeak > heapBudget)
+	{
+		printf("The heap grew to %lld MB, over the budget of %lld MB\n", (long long)heapPeak / (1024 * 1024), heapBudget / (1024 * 1024));
+		return false;
+	}
+	return true;
+}
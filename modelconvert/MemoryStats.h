@@ -0,0 +1,18 @@
+#pragma once
+
+#include <atomic>
+
+// Counts the allocations of every stage of a conversion. The global operator new and delete are replaced with ones that
+// count, when the counting is enabled. The stages are the TRACE_SCOPEs that are active on the allocating thread. On exit
+// a table is printed with the number of allocations, the bytes allocated and the highest heap size reached during each
+// stage, and the converter fails when the heap grew over the budget
+
+extern std::atomic<bool> memoryStatsEnabled;
+
+// budget is in bytes, 0 for no budget
+void enableMemoryStats(long long budget);
+// makes name the stage of this thread, returns the stage that was active, to pass to leaveMemoryStage
+int enterMemoryStage(const char* name);
+void leaveMemoryStage(int previous);
+// prints the table, returns false when the heap grew over the budget
+bool printMemoryStats();
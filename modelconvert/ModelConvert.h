@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <blib/json.h>
+
+struct aiScene;
+struct aiAnimation;
+namespace Assimp { class Importer; }
+
+// sets flags to the assimp post processing of a named profile, returns false if there is no profile with that name
+bool importProfile(const std::string &name, unsigned int &flags);
+void printImportProfiles();
+
+struct Options
+{
+	float resampleRate;		// frames per second to resample animations at, 0 keeps the original keys
+	float reducePosition;	// maximum world space error when removing position keys, 0 keeps all keys
+	float reduceRotation;	// maximum world space error when removing rotation keys, 0 keeps all keys
+	float reduceScale;		// maximum world space error when removing scale keys, 0 keeps all keys
+	bool binaryAnimations;	// write animations as quantized binary .anim files instead of .anim.json
+	int threads;			// worker threads for exporting, 0 uses one per core
+	std::string cacheDirectory;	// directory to keep converted models in, empty to always convert
+	int cacheSize;			// in megabytes
+	bool cacheLinks;		// hard link outputs from the cache instead of copying them
+	std::string sceneCacheDirectory;	// directory to keep post processed assimp scenes in, empty to always import
+	unsigned int importFlags;	// assimp post processing steps, set from an import profile
+	bool nativeSteps;		// run the slowest post processing steps with our own multithreaded code instead of assimp's
+	bool nativeObj;			// read obj files with our own multithreaded reader, and post process them with the native steps
+	int prefetch;			// in batch runs, how many files are read ahead of the conversion and queued for writing
+	int jobs;				// in batch runs, conversions running at the same time as separate processes, 0 uses one per core
+	int memoryBudget;		// in megabytes, the estimated peak memory of all running conversions together, 0 for no limit
+	std::string memoryHistory;	// file with the peak memory of earlier conversions, used to estimate new ones
+	bool isolate;			// in batch runs, convert every file in a process forked from the converter
+	int jobTimeout;			// in seconds, isolated conversions that take longer are stopped, 0 for no limit
+	int jobMemory;			// in megabytes, the address space of an isolated conversion, 0 for no limit
+	int benchmarkRepeats;
+	std::string baseline;		// benchmark results to compare with
+	std::string saveBaseline;	// file to write the benchmark results to
+	float regressionThreshold;	// in percent, how much slower a stage can get before the benchmark fails
+	int deadline;			// in seconds, conversions that take longer are cancelled, 0 for no limit
+	std::string outputSuffix;	// added to the names of the files the converters write themselves, outputFiles has the names without it
+
+	Options() : resampleRate(0), reducePosition(0), reduceRotation(0), reduceScale(0), binaryAnimations(false), threads(0), cacheSize(1024), cacheLinks(false), nativeSteps(false), nativeObj(false), prefetch(2), jobs(1), memoryBudget(0), memoryHistory("modelconvert-memory.json"), isolate(false), jobTimeout(0), jobMemory(0), benchmarkRepeats(5), regressionThreshold(10), deadline(0)
+	{
+		importProfile("production", importFlags);
+	}
+};
+
+// reads the option at args[i] and its value when it is one that changes a conversion, error is set for invalid values
+bool conversionOption(const std::vector<std::string> &args, size_t &i, Options &options, std::string &error);
+// the extension of filename with its dot, in lower case. Empty when it has none
+std::string fileExtension(const std::string &filename);
+// converts a model with the converter for its extension, returns null when it can't be converted
+blib::json::Value convertModel(const std::string &filename, const Options &options, std::vector<std::string> &outputFiles);
+// removes the files a converter already wrote, for a conversion that was cancelled or failed, and clears outputFiles
+void removeOutputFiles(std::vector<std::string> &outputFiles, const Options &options);
+void writeModel(blib::json::Value &data, std::ostream &out);
+void writeModel(blib::json::Value &data, const std::string &outfile);
+// converts every file to file.json, returns non-zero when a file could not be converted
+int convertBatch(const std::vector<std::string> &files, const Options &options);
+// converts every file in a process of its own, running command followed by the filename
+int scheduleBatch(const std::vector<std::string> &command, const std::vector<std::string> &files, const Options &options);
+// converts every file in a forked process, so a crash or hang in an importer only fails that file
+int isolatedBatch(const std::vector<std::string> &command, const std::vector<std::string> &files, const Options &options);
+// converts the models in the directories when they, or the files they use, change. Runs until it is stopped
+int watchDirectories(const std::vector<std::string> &command, const std::vector<std::string> &directories, const Options &options);
+// serves conversion requests on a unix socket until it is stopped, from workers that only set up once
+int runDaemon(const std::string &socketPath, const Options &options);
+// has the daemon on socketPath convert a file, outfile is file.json when empty
+int sendToDaemon(const std::string &socketPath, const std::string &filename, const std::string &outfile, const std::vector<std::string> &optionArgs);
+
+// convertAssimp and convertAssimpAnim add the names of the files they write themselves to outputFiles
+// skeleton is set to the bones of the model, in the form of the .skel.json files, and left null when it has none
+blib::json::Value convertPmd(std::string filename, blib::json::Value &skeleton);
+blib::json::Value convertPmx(const std::string &filename);
+blib::json::Value convertAssimp(std::string filename, const Options &options, std::vector<std::string> &outputFiles);
+blib::json::Value convertAssimpAnim(const std::string &filename, const Options &options, std::vector<std::string> &outputFiles);
+void writeSkeleton(const blib::json::Value &skeleton, const std::string &outfile);
+
+bool profileImportSteps(const std::string &filename, const Options &options);
+// writes generated models of a few sizes to directory, and times every conversion path on them
+int runBenchmark(const std::string &directory, const Options &options);
+
+// imports like ReadFileFromMemory, but does the slowest post processing steps itself, on all meshes in parallel
+const aiScene* readFileNative(Assimp::Importer &importer, const char* data, int len, const char* hint, unsigned int flags, int threads);
+bool checkNativeSteps(const std::string &filename, const Options &options);
+// compares every native step with assimp's on generated models, returns false when one of them differs
+bool testNativeSteps(const Options &options);
+// runs the native steps of flags on a scene that was not imported by assimp
+void processSceneNative(const aiScene* scene, unsigned int flags, int threads);
+// reads an obj file and its materials, parsing chunks of it in parallel. Polygons are triangulated, and the meshes are
+// split per material. flags are the assimp post processing steps, of which only the ones that change how the meshes are
+// built are done here. Returns NULL and sets error when the file could not be read
+aiScene* readObjNative(const std::string &filename, unsigned int flags, int threads, std::string &error);
+// prints mesh, skinning, animation and output size statistics of a model, without converting it
+bool printModelStats(const std::string &filename, const Options &options);
+
+void reduceAnimation(const aiScene* scene, aiAnimation* animation, const Options &options);
+// returns false when the clip does not fit in the binary format
+bool writeBinaryAnimation(const std::string &filename, const aiAnimation* animation, const std::vector<int> &bindings, const Options &options);
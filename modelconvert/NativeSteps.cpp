@@ -0,0 +1,766 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <sstream>
+#include <fstream>
+#include <stdio.h>
+
+#include <blib/util/FileSystem.h>
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include "ModelConvert.h"
+#include "ThreadPool.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "Logger.h"
+
+// Our own versions of the assimp steps that take most of the import time on large meshes. They follow the assimp 3
+// implementations with their default settings, so the output matches, but every mesh is processed on its own thread.
+// --check-native-steps compares the results with assimp's on a model, --test-native-steps on generated ones
+
+static const unsigned int nativeImportSteps = aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices | aiProcess_ImproveCacheLocality;
+
+// assimp steps that run after vertex joining and before the cache locality optimization
+static const unsigned int lateSteps = aiProcess_SplitLargeMeshes | aiProcess_MakeLeftHanded | aiProcess_FlipUVs | aiProcess_FlipWindingOrder | aiProcess_Debone | aiProcess_LimitBoneWeights;
+
+static const float maxTangentAngle = 45.0f * 3.14159265f / 180.0f;	// AI_CONFIG_PP_CT_MAX_SMOOTHING_ANGLE
+static const unsigned int cacheSize = 12;	// AI_CONFIG_PP_ICL_PTCACHE_SIZE
+
+
+//finds vertices at the same position, by sorting them on their distance to a plane like assimp's SpatialSort
+class SpatialSort
+{
+	struct Entry
+	{
+		unsigned int index;
+		float distance;
+		aiVector3D position;
+		bool operator <(const Entry &other) const { return distance < other.distance; }
+	};
+	std::vector<Entry> entries;
+	aiVector3D planeNormal;
+public:
+	SpatialSort(const aiVector3D* positions, unsigned int count) : planeNormal(0.8523f, 0.34321f, 0.5736f)
+	{
+		planeNormal.Normalize();
+		entries.resize(count);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			entries[i].index = i;
+			entries[i].position = positions[i];
+			entries[i].distance = positions[i] * planeNormal;
+		}
+		std::sort(entries.begin(), entries.end());
+	}
+
+	void findPositions(const aiVector3D &position, float radius, std::vector<unsigned int> &results) const
+	{
+		results.clear();
+		Entry search;
+		search.distance = position * planeNormal - radius;
+		float maxDistance = search.distance + 2 * radius;
+		for (std::vector<Entry>::const_iterator it = std::lower_bound(entries.begin(), entries.end(), search); it != entries.end() && it->distance < maxDistance; ++it)
+			if ((it->position - position).SquareLength() < radius * radius)
+				results.push_back(it->index);
+	}
+};
+
+static float positionEpsilon(const aiMesh* mesh)
+{
+	if (mesh->mNumVertices == 0)
+		return 0;
+	aiVector3D low = mesh->mVertices[0];
+	aiVector3D high = mesh->mVertices[0];
+	for (unsigned int i = 1; i < mesh->mNumVertices; i++)
+	{
+		for (int ii = 0; ii < 3; ii++)
+		{
+			low[ii] = std::min(low[ii], mesh->mVertices[i][ii]);
+			high[ii] = std::max(high[ii], mesh->mVertices[i][ii]);
+		}
+	}
+	return (high - low).Length() * 1e-4f;
+}
+
+static bool isSpecial(const aiVector3D &v)
+{
+	return !std::isfinite(v.x) || !std::isfinite(v.y) || !std::isfinite(v.z);
+}
+
+
+//GenSmoothNormals with the default smoothing angle of 175 degrees, which averages the normals of all faces at a position
+static void genSmoothNormals(aiMesh* mesh, const SpatialSort &sort, float epsilon)
+{
+	TRACE_SCOPE("GenSmoothNormals (native)");
+	if (mesh->mNormals || !(mesh->mPrimitiveTypes & (aiPrimitiveType_TRIANGLE | aiPrimitiveType_POLYGON)))
+		return;
+
+	std::vector<aiVector3D> faceNormals(mesh->mNumVertices);
+	const float qnan = std::numeric_limits<float>::quiet_NaN();
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		const aiFace &face = mesh->mFaces[i];
+		if (face.mNumIndices < 3)
+		{
+			for (unsigned int ii = 0; ii < face.mNumIndices; ii++)
+				faceNormals[face.mIndices[ii]] = aiVector3D(qnan, qnan, qnan);
+			continue;
+		}
+		const aiVector3D &v1 = mesh->mVertices[face.mIndices[0]];
+		const aiVector3D &v2 = mesh->mVertices[face.mIndices[1]];
+		const aiVector3D &v3 = mesh->mVertices[face.mIndices[face.mNumIndices - 1]];
+		aiVector3D normal = ((v2 - v1) ^ (v3 - v1)).Normalize();
+		for (unsigned int ii = 0; ii < face.mNumIndices; ii++)
+			faceNormals[face.mIndices[ii]] = normal;
+	}
+
+	mesh->mNormals = new aiVector3D[mesh->mNumVertices];
+	std::vector<bool> done(mesh->mNumVertices, false);
+	std::vector<unsigned int> found;
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	{
+		if (done[i])
+			continue;
+		sort.findPositions(mesh->mVertices[i], epsilon, found);
+		aiVector3D normal;
+		for (size_t ii = 0; ii < found.size(); ii++)
+			if (!std::isnan(faceNormals[found[ii]].x))
+				normal += faceNormals[found[ii]];
+		normal.Normalize();
+		for (size_t ii = 0; ii < found.size(); ii++)
+		{
+			mesh->mNormals[found[ii]] = normal;
+			done[found[ii]] = true;
+		}
+	}
+}
+
+//CalcTangentSpace on the first texture coordinate set
+static void calcTangentSpace(aiMesh* mesh, const SpatialSort &sort, float epsilon)
+{
+	TRACE_SCOPE("CalcTangentSpace (native)");
+	if (mesh->mTangents || !(mesh->mPrimitiveTypes & (aiPrimitiveType_TRIANGLE | aiPrimitiveType_POLYGON)) || !mesh->mNormals || !mesh->HasTextureCoords(0))
+		return;
+
+	mesh->mTangents = new aiVector3D[mesh->mNumVertices];
+	mesh->mBitangents = new aiVector3D[mesh->mNumVertices];
+	const aiVector3D* positions = mesh->mVertices;
+	const aiVector3D* normals = mesh->mNormals;
+	const aiVector3D* texCoords = mesh->mTextureCoords[0];
+	aiVector3D* tangents = mesh->mTangents;
+	aiVector3D* bitangents = mesh->mBitangents;
+	const float qnan = std::numeric_limits<float>::quiet_NaN();
+
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		const aiFace &face = mesh->mFaces[i];
+		if (face.mNumIndices < 3)
+		{
+			for (unsigned int ii = 0; ii < face.mNumIndices; ii++)
+			{
+				tangents[face.mIndices[ii]] = aiVector3D(qnan, qnan, qnan);
+				bitangents[face.mIndices[ii]] = aiVector3D(qnan, qnan, qnan);
+			}
+			continue;
+		}
+
+		//polygons are supposed to be flat, so the first three corners are enough
+		unsigned int p0 = face.mIndices[0], p1 = face.mIndices[1], p2 = face.mIndices[2];
+		aiVector3D v = positions[p1] - positions[p0];
+		aiVector3D w = positions[p2] - positions[p0];
+		float sx = texCoords[p1].x - texCoords[p0].x, sy = texCoords[p1].y - texCoords[p0].y;
+		float tx = texCoords[p2].x - texCoords[p0].x, ty = texCoords[p2].y - texCoords[p0].y;
+		float dirCorrection = (tx * sy - ty * sx) < 0.0f ? -1.0f : 1.0f;
+		if (sx == 0 && sy == 0 && tx == 0 && ty == 0)
+		{
+			sx = 0; sy = 1;
+			tx = 1; ty = 0;
+		}
+
+		aiVector3D tangent = (w * sy - v * ty) * dirCorrection;
+		aiVector3D bitangent = (w * sx - v * tx) * dirCorrection;
+		for (unsigned int ii = 0; ii < face.mNumIndices; ii++)
+		{
+			unsigned int p = face.mIndices[ii];
+			aiVector3D localTangent = tangent - normals[p] * (tangent * normals[p]);
+			aiVector3D localBitangent = bitangent - normals[p] * (bitangent * normals[p]);
+			localTangent.Normalize();
+			localBitangent.Normalize();
+
+			//rebuild one from the other when only one of them is broken
+			if (isSpecial(localTangent) && !isSpecial(localBitangent))
+				localTangent = (normals[p] ^ localBitangent).Normalize();
+			else if (!isSpecial(localTangent) && isSpecial(localBitangent))
+				localBitangent = (localTangent ^ normals[p]).Normalize();
+
+			tangents[p] = localTangent;
+			bitangents[p] = localBitangent;
+		}
+	}
+
+	//average tangents of vertices at the same position that have the same normal and similar tangents
+	const float limit = cosf(maxTangentAngle);
+	std::vector<bool> done(mesh->mNumVertices, false);
+	std::vector<unsigned int> found;
+	std::vector<unsigned int> close;
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	{
+		if (done[i])
+			continue;
+		sort.findPositions(positions[i], epsilon, found);
+		close.clear();
+		close.push_back(i); // assimp counts the vertex itself twice, as it is also one of the found vertices
+		for (size_t ii = 0; ii < found.size(); ii++)
+		{
+			unsigned int index = found[ii];
+			if (done[index] || normals[index] * normals[i] < 0.9999f || tangents[index] * tangents[i] < limit || bitangents[index] * bitangents[i] < limit)
+				continue;
+			close.push_back(index);
+			done[index] = true;
+		}
+
+		aiVector3D tangent;
+		aiVector3D bitangent;
+		for (size_t ii = 0; ii < close.size(); ii++)
+		{
+			tangent += tangents[close[ii]];
+			bitangent += bitangents[close[ii]];
+		}
+		tangent.Normalize();
+		bitangent.Normalize();
+		for (size_t ii = 0; ii < close.size(); ii++)
+		{
+			tangents[close[ii]] = tangent;
+			bitangents[close[ii]] = bitangent;
+			done[close[ii]] = true;
+		}
+	}
+}
+
+static bool sameVertex(const aiMesh* mesh, unsigned int a, unsigned int b)
+{
+	const float squareEpsilon = 1e-5f * 1e-5f;
+	//positions were already matched by the spatial sort
+	if (mesh->mNormals && (mesh->mNormals[a] - mesh->mNormals[b]).SquareLength() > squareEpsilon)
+		return false;
+	if (mesh->mTangents && (mesh->mTangents[a] - mesh->mTangents[b]).SquareLength() > squareEpsilon)
+		return false;
+	if (mesh->mBitangents && (mesh->mBitangents[a] - mesh->mBitangents[b]).SquareLength() > squareEpsilon)
+		return false;
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+		if (mesh->mTextureCoords[i] && (mesh->mTextureCoords[i][a] - mesh->mTextureCoords[i][b]).SquareLength() > squareEpsilon)
+			return false;
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++)
+	{
+		if (!mesh->mColors[i])
+			continue;
+		aiColor4D diff = mesh->mColors[i][a] - mesh->mColors[i][b];
+		if (diff.r * diff.r + diff.g * diff.g + diff.b * diff.b + diff.a * diff.a > squareEpsilon)
+			return false;
+	}
+	return true;
+}
+
+template<class T>
+static void compact(T* &values, const std::vector<unsigned int> &unique)
+{
+	if (!values)
+		return;
+	T* newValues = new T[unique.size()];
+	for (size_t i = 0; i < unique.size(); i++)
+		newValues[i] = values[unique[i]];
+	delete[] values;
+	values = newValues;
+}
+
+//JoinIdenticalVertices, every vertex is merged into the first earlier vertex with the same attributes
+static void joinIdenticalVertices(aiMesh* mesh, const SpatialSort &sort, float epsilon)
+{
+	TRACE_SCOPE("JoinIdenticalVertices (native)");
+	if (mesh->mNumVertices == 0 || mesh->mNumFaces == 0)
+		return;
+
+	const unsigned int duplicate = 0x80000000;
+	std::vector<unsigned int> replaceIndex(mesh->mNumVertices, 0xffffffff);
+	std::vector<unsigned int> unique;
+	std::vector<unsigned int> found;
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	{
+		sort.findPositions(mesh->mVertices[i], epsilon, found);
+		unsigned int match = 0xffffffff;
+		for (size_t ii = 0; ii < found.size(); ii++)
+		{
+			unsigned int uniqueIndex = replaceIndex[found[ii]];
+			if (uniqueIndex & duplicate) // not handled yet, or merged into another vertex
+				continue;
+			if (sameVertex(mesh, unique[uniqueIndex], i))
+			{
+				match = uniqueIndex;
+				break;
+			}
+		}
+		if (match != 0xffffffff)
+			replaceIndex[i] = match | duplicate;
+		else
+		{
+			replaceIndex[i] = (unsigned int)unique.size();
+			unique.push_back(i);
+		}
+	}
+
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		for (unsigned int ii = 0; ii < mesh->mFaces[i].mNumIndices; ii++)
+			mesh->mFaces[i].mIndices[ii] = replaceIndex[mesh->mFaces[i].mIndices[ii]] & ~duplicate;
+
+	//weights of merged vertices are dropped, the vertex they were merged into has its own
+	for (unsigned int i = 0; i < mesh->mNumBones; i++)
+	{
+		aiBone* bone = mesh->mBones[i];
+		std::vector<aiVertexWeight> weights;
+		for (unsigned int ii = 0; ii < bone->mNumWeights; ii++)
+			if (!(replaceIndex[bone->mWeights[ii].mVertexId] & duplicate))
+				weights.push_back(aiVertexWeight(replaceIndex[bone->mWeights[ii].mVertexId], bone->mWeights[ii].mWeight));
+		delete[] bone->mWeights;
+		bone->mWeights = NULL;
+		bone->mNumWeights = (unsigned int)weights.size();
+		if (!weights.empty())
+		{
+			bone->mWeights = new aiVertexWeight[weights.size()];
+			std::copy(weights.begin(), weights.end(), bone->mWeights);
+		}
+	}
+
+	compact(mesh->mVertices, unique);
+	compact(mesh->mNormals, unique);
+	compact(mesh->mTangents, unique);
+	compact(mesh->mBitangents, unique);
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+		compact(mesh->mTextureCoords[i], unique);
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++)
+		compact(mesh->mColors[i], unique);
+	mesh->mNumVertices = (unsigned int)unique.size();
+}
+
+//ImproveCacheLocality, reorders the triangles with the Tipsify algorithm from Sander et al., like assimp
+static void improveCacheLocality(aiMesh* mesh)
+{
+	TRACE_SCOPE("ImproveCacheLocality (native)");
+	if (mesh->mNumFaces == 0 || mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE || mesh->mNumVertices <= cacheSize)
+		return;
+
+	//triangles around every vertex
+	std::vector<unsigned int> offsets(mesh->mNumVertices + 1, 0);
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		for (int ii = 0; ii < 3; ii++)
+			offsets[mesh->mFaces[i].mIndices[ii] + 1]++;
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+		offsets[i + 1] += offsets[i];
+	std::vector<unsigned int> adjacency(mesh->mNumFaces * 3);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		for (int ii = 0; ii < 3; ii++)
+			adjacency[fill[mesh->mFaces[i].mIndices[ii]]++] = i;
+
+	std::vector<unsigned int> live(mesh->mNumVertices);
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+		live[i] = offsets[i + 1] - offsets[i];
+	std::vector<unsigned int> stamps(mesh->mNumVertices, 0);
+	std::vector<bool> emitted(mesh->mNumFaces, false);
+	std::vector<unsigned int> deadEnds;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> order;
+	order.reserve(mesh->mNumFaces);
+
+	unsigned int time = cacheSize + 1;
+	unsigned int cursor = 0;
+	int vertex = 0;
+	while (vertex != -1)
+	{
+		//emit all triangles around the fanning vertex
+		candidates.clear();
+		for (unsigned int i = offsets[vertex]; i < offsets[vertex + 1]; i++)
+		{
+			unsigned int face = adjacency[i];
+			if (emitted[face])
+				continue;
+			for (int ii = 0; ii < 3; ii++)
+			{
+				unsigned int index = mesh->mFaces[face].mIndices[ii];
+				deadEnds.push_back(index);
+				candidates.push_back(index);
+				live[index]--;
+				if (time - stamps[index] > cacheSize)
+					stamps[index] = time++;
+			}
+			emitted[face] = true;
+			order.push_back(face);
+		}
+
+		//the next fanning vertex is the one that stays in the cache longest once its triangles are emitted
+		vertex = -1;
+		int best = -1;
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			unsigned int index = candidates[i];
+			if (live[index] == 0)
+				continue;
+			int priority = 0;
+			if (time - stamps[index] + 2 * live[index] <= cacheSize)
+				priority = time - stamps[index];
+			if (priority > best)
+			{
+				best = priority;
+				vertex = index;
+			}
+		}
+
+		//dead end, take a recently used vertex with triangles left, or the next one in input order
+		while (vertex == -1 && !deadEnds.empty())
+		{
+			if (live[deadEnds.back()] > 0)
+				vertex = deadEnds.back();
+			deadEnds.pop_back();
+		}
+		for (; vertex == -1 && cursor < mesh->mNumVertices; cursor++)
+			if (live[cursor] > 0)
+				vertex = cursor;
+	}
+
+	std::vector<unsigned int> indices;
+	indices.reserve(mesh->mNumFaces * 3);
+	for (size_t i = 0; i < order.size(); i++)
+		indices.insert(indices.end(), mesh->mFaces[order[i]].mIndices, mesh->mFaces[order[i]].mIndices + 3);
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		std::copy(indices.begin() + i * 3, indices.begin() + i * 3 + 3, mesh->mFaces[i].mIndices);
+}
+
+
+static void runSteps(const aiScene* scene, unsigned int flags, int threads)
+{
+	ThreadPool pool(threads);
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+	{
+		aiMesh* mesh = scene->mMeshes[i];
+		pool.addJob([mesh, flags]()
+		{
+			if (flags & aiProcess_ImproveCacheLocality)
+			{
+				improveCacheLocality(mesh);
+				return;
+			}
+			TRACE_SCOPE("native mesh");
+			float epsilon = positionEpsilon(mesh);
+			SpatialSort sort(mesh->mVertices, mesh->mNumVertices);
+			if (flags & aiProcess_GenSmoothNormals)
+				genSmoothNormals(mesh, sort, epsilon);
+			if (flags & aiProcess_CalcTangentSpace)
+				calcTangentSpace(mesh, sort, epsilon);
+			if (flags & aiProcess_JoinIdenticalVertices)
+				joinIdenticalVertices(mesh, sort, epsilon);
+		});
+	}
+	pool.waitForJobs();
+}
+
+//runs the native steps of flags on a scene that assimp did not import, like the one of the native obj reader
+void processSceneNative(const aiScene* scene, unsigned int flags, int threads)
+{
+	runSteps(scene, flags & (aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices), threads);
+	if (flags & aiProcess_JoinIdenticalVertices)
+		const_cast<aiScene*>(scene)->mFlags |= AI_SCENE_FLAGS_NON_VERBOSE_FORMAT;
+	if (flags & aiProcess_ImproveCacheLocality)
+		runSteps(scene, aiProcess_ImproveCacheLocality, threads);
+}
+
+//imports with assimp, but runs the native steps in their place in assimp's pipeline
+const aiScene* readFileNative(Assimp::Importer &importer, const char* data, int len, const char* hint, unsigned int flags, int threads)
+{
+	const aiScene* scene;
+	{
+		TRACE_SCOPE("assimp import");
+		scene = importer.ReadFileFromMemory(data, len, flags & ~(nativeImportSteps | lateSteps), hint);
+	}
+	if (!scene)
+		return NULL;
+	if (!progress.update("native steps", 0))
+		return NULL;
+	runSteps(scene, flags & (aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices), threads);
+	if (flags & aiProcess_JoinIdenticalVertices)
+		const_cast<aiScene*>(scene)->mFlags |= AI_SCENE_FLAGS_NON_VERBOSE_FORMAT;
+	if (flags & lateSteps)
+	{
+		TRACE_SCOPE("assimp late steps");
+		scene = importer.ApplyPostProcessing(flags & lateSteps);
+		if (!scene)
+			return NULL;
+	}
+	if (!progress.update("native steps", 0.5f))
+		return NULL;
+	if (flags & aiProcess_ImproveCacheLocality)
+		runSteps(scene, aiProcess_ImproveCacheLocality, threads);
+	return scene;
+}
+
+
+//average cache misses per triangle for a FIFO cache
+static float acmr(const aiMesh* mesh)
+{
+	if (mesh->mNumFaces == 0)
+		return 0;
+	std::vector<int> stamps(mesh->mNumVertices, -1000000);
+	int time = 0;
+	int misses = 0;
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		for (unsigned int ii = 0; ii < mesh->mFaces[i].mNumIndices; ii++)
+		{
+			unsigned int index = mesh->mFaces[i].mIndices[ii];
+			if (time - stamps[index] > (int)cacheSize)
+			{
+				stamps[index] = time++;
+				misses++;
+			}
+		}
+	}
+	return misses / (float)mesh->mNumFaces;
+}
+
+static float maxAngle(const aiVector3D* a, const aiVector3D* b, unsigned int count)
+{
+	if (!a || !b)
+		return a == b ? 0 : 180;
+	float ret = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (isSpecial(a[i]) || isSpecial(b[i]))
+			continue;
+		ret = std::max(ret, acosf(std::min(1.0f, std::max(-1.0f, a[i] * b[i]))) * 180 / 3.14159265f);
+	}
+	return ret;
+}
+
+//compares a scene post processed with assimp's steps with one done with the native steps. Vertices are joined in the
+//same order, so vertex attributes can be compared directly. The triangle order depends on small differences in the
+//cache simulation, so only the resulting cache efficiency is compared
+static bool compareScenes(const aiScene* expected, const aiScene* actual)
+{
+	if (expected->mNumMeshes != actual->mNumMeshes)
+	{
+		printf("Different mesh count: %i with assimp steps, %i with native steps\n", (int)expected->mNumMeshes, (int)actual->mNumMeshes);
+		return false;
+	}
+
+	bool ok = true;
+	printf("%-6s %21s %21s %10s %10s %10s %15s\n", "mesh", "vertices", "faces", "normals", "tangents", "bitangents", "acmr");
+	printf("%-6s %10s %10s %10s %10s %10s %10s %10s %7s %7s\n", "", "assimp", "native", "assimp", "native", "max deg", "max deg", "max deg", "assimp", "native");
+	for (unsigned int i = 0; i < expected->mNumMeshes; i++)
+	{
+		const aiMesh* a = expected->mMeshes[i];
+		const aiMesh* b = actual->mMeshes[i];
+		float normals = 0, tangents = 0, bitangents = 0;
+		bool same = a->mNumVertices == b->mNumVertices && a->mNumFaces == b->mNumFaces;
+		if (same)
+		{
+			normals = maxAngle(a->mNormals, b->mNormals, a->mNumVertices);
+			tangents = maxAngle(a->mTangents, b->mTangents, a->mNumVertices);
+			bitangents = maxAngle(a->mBitangents, b->mBitangents, a->mNumVertices);
+			same = normals < 1 && tangents < 1 && bitangents < 1 && acmr(b) <= acmr(a) * 1.05f;
+		}
+		printf("%-6i %10i %10i %10i %10i %10.3f %10.3f %10.3f %7.3f %7.3f %s\n", (int)i, (int)a->mNumVertices, (int)b->mNumVertices, (int)a->mNumFaces, (int)b->mNumFaces,
+			normals, tangents, bitangents, acmr(a), acmr(b), same ? "" : "DIFFERENT");
+		ok = ok && same;
+	}
+	return ok;
+}
+
+//imports the model with assimp's steps and with the native ones, and compares the results
+bool checkNativeSteps(const std::string &filename, const Options &options)
+{
+	blib::util::FileSystem::registerHandler(new blib::util::PhysicalFileSystemHandler(""));
+	char* data;
+	int len = blib::util::FileSystem::getData(filename, data);
+	if (len == 0)
+	{
+		LOG(Error) << "Error opening file " << filename;
+		return false;
+	}
+	std::string hint = fileExtension(filename);
+
+	Assimp::Importer assimpImporter;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	const aiScene* expected = assimpImporter.ReadFileFromMemory(data, len, options.importFlags, hint.c_str());
+	double assimpTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	Assimp::Importer nativeImporter;
+	start = std::chrono::high_resolution_clock::now();
+	const aiScene* actual = readFileNative(nativeImporter, data, len, hint.c_str(), options.importFlags, options.threads);
+	double nativeTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	delete[] data;
+
+	if (!expected || !actual)
+	{
+		LOG(Error) << "Could not import " << filename << ": " << assimpImporter.GetErrorString() << " " << nativeImporter.GetErrorString();
+		return false;
+	}
+	printf("Import with assimp steps: %.2f ms, with native steps: %.2f ms\n", assimpTime, nativeTime);
+	bool ok = compareScenes(expected, actual);
+	printf(ok ? "Native steps match assimp\n" : "Native steps do not match assimp\n");
+	return ok;
+}
+
+
+//an obj model without normals for the native step tests: a rippled grid with texture coordinates, and a closed box
+//that shares its corners between faces with different normals, so joining vertices and smoothing has hard cases
+static std::string testModel()
+{
+	std::ostringstream out;
+	const int side = 40;
+	for (int y = 0; y <= side; y++)
+		for (int x = 0; x <= side; x++)
+			out << "v " << x * 0.25f << " " << sinf(x * 0.4f) * cosf(y * 0.3f) << " " << y * 0.25f << "\n";
+	for (int y = 0; y <= side; y++)
+		for (int x = 0; x <= side; x++)
+			out << "vt " << x / (float)side << " " << y / (float)side << "\n";
+	out << "o grid\n";
+	for (int y = 0; y < side; y++)
+	{
+		for (int x = 0; x < side; x++)
+		{
+			int a = y * (side + 1) + x + 1;
+			int b = a + 1;
+			int c = a + side + 1;
+			int d = c + 1;
+			out << "f " << a << "/" << a << " " << c << "/" << c << " " << d << "/" << d << " " << b << "/" << b << "\n";
+		}
+	}
+
+	int base = (side + 1) * (side + 1);
+	for (int i = 0; i < 8; i++)
+		out << "v " << 20 + (i & 1) << " " << ((i >> 1) & 1) << " " << ((i >> 2) & 1) << "\n";
+	const int box[6][4] = { { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 } };
+	const int corners[4] = { 1, 2, 4, 3 };
+	out << "o box\n";
+	for (int i = 0; i < 6; i++)
+	{
+		out << "f";
+		for (int ii = 0; ii < 4; ii++)
+			out << " " << base + box[i][ii] + 1 << "/" << corners[ii];
+		out << "\n";
+	}
+	return out.str();
+}
+
+//a rippled grid with texture coordinates and normals, large enough to be split into several chunks by the native obj
+//reader. All vertices come before the faces, so with relative indices the faces in later chunks only point back into
+//earlier chunks
+static void writeChunkedObj(const std::string &filename, bool relative)
+{
+	std::ofstream out(filename.c_str());
+	const int side = 200;
+	const int count = (side + 1) * (side + 1);
+	for (int y = 0; y <= side; y++)
+		for (int x = 0; x <= side; x++)
+			out << "v " << x * 0.25f << " " << sinf(x * 0.4f) * cosf(y * 0.3f) << " " << y * 0.25f << "\n";
+	for (int y = 0; y <= side; y++)
+		for (int x = 0; x <= side; x++)
+			out << "vt " << x / (float)side << " " << y / (float)side << "\n";
+	for (int y = 0; y <= side; y++)
+		for (int x = 0; x <= side; x++)
+		{
+			aiVector3D normal = aiVector3D(-0.4f * cosf(x * 0.4f) * cosf(y * 0.3f), 0.25f, 0.3f * sinf(x * 0.4f) * sinf(y * 0.3f)).Normalize();
+			out << "vn " << normal.x << " " << normal.y << " " << normal.z << "\n";
+		}
+	out << "o grid\n";
+	for (int y = 0; y < side; y++)
+	{
+		for (int x = 0; x < side; x++)
+		{
+			int corners[4] = { y * (side + 1) + x, (y + 1) * (side + 1) + x, (y + 1) * (side + 1) + x + 1, y * (side + 1) + x + 1 };
+			out << "f";
+			for (int i = 0; i < 4; i++)
+			{
+				int index = relative ? corners[i] - count : corners[i] + 1;
+				out << " " << index << "/" << index << "/" << index;
+			}
+			out << "\n";
+		}
+	}
+}
+
+//reads the chunked obj with absolute and with relative indices, they have to give the same model
+static bool testRelativeIndices(const Options &options)
+{
+	const unsigned int flags = aiProcess_Triangulate | aiProcess_CalcTangentSpace;
+	writeChunkedObj("native-steps-test.obj", false);
+	writeChunkedObj("native-steps-test-relative.obj", true);
+	std::string error;
+	aiScene* expected = readObjNative("native-steps-test.obj", flags, options.threads, error);
+	aiScene* actual = expected ? readObjNative("native-steps-test-relative.obj", flags, options.threads, error) : NULL;
+	remove("native-steps-test.obj");
+	remove("native-steps-test-relative.obj");
+	bool ok = expected && actual;
+	if (!ok)
+		LOG(Error) << "Could not read the test model: " << error;
+	else
+	{
+		processSceneNative(expected, flags, options.threads);
+		processSceneNative(actual, flags, options.threads);
+		ok = compareScenes(expected, actual);
+	}
+	delete expected;
+	delete actual;
+	return ok;
+}
+
+//runs every native step on a generated model, with the steps it depends on, and compares it with assimp's step.
+//Needs no model, so it can run as a check on any build
+bool testNativeSteps(const Options &options)
+{
+	struct Step
+	{
+		const char* name;
+		unsigned int flags;
+	};
+	const unsigned int base = aiProcess_Triangulate;
+	const Step steps[] = {
+		{ "smooth normals", base | aiProcess_GenSmoothNormals },
+		{ "tangent space", base | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace },
+		{ "join identical vertices", base | aiProcess_GenSmoothNormals | aiProcess_JoinIdenticalVertices },
+		{ "improve cache locality", base | aiProcess_GenSmoothNormals | aiProcess_JoinIdenticalVertices | aiProcess_ImproveCacheLocality },
+		{ "all native steps", base | nativeImportSteps },
+	};
+
+	std::string model = testModel();
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++)
+	{
+		printf("%s\n", steps[i].name);
+		Assimp::Importer assimpImporter;
+		const aiScene* expected = assimpImporter.ReadFileFromMemory(model.c_str(), model.size(), steps[i].flags, "obj");
+		Assimp::Importer nativeImporter;
+		const aiScene* actual = readFileNative(nativeImporter, model.c_str(), (int)model.size(), "obj", steps[i].flags, options.threads);
+		bool ok = expected && actual;
+		if (!ok)
+			LOG(Error) << "Could not import the test model: " << assimpImporter.GetErrorString() << " " << nativeImporter.GetErrorString();
+		else
+			ok = compareScenes(expected, actual);
+		printf("%s\n\n", ok ? "ok" : "FAILED");
+		if (!ok)
+			failed++;
+	}
+	if (failed > 0)
+		printf("%i of %i native steps do not match assimp\n", failed, (int)(sizeof(steps) / sizeof(steps[0])));
+	else
+		printf("All native steps match assimp\n");
+
+	printf("\nobj reader, relative indices over several chunks\n");
+	bool relativeOk = testRelativeIndices(options);
+	printf("%s\n", relativeOk ? "ok" : "FAILED");
+	return failed == 0 && relativeOk;
+}
@@ -0,0 +1,702 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cmath>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include "ModelConvert.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "Logger.h"
+
+// Reads obj files without assimp, for scans of several gigabytes. The file is mapped into memory instead of copied, and
+// split at line ends into chunks that are parsed on all cores. Every chunk keeps its own vertex lists and faces, with
+// indices that count from the end of the chunk (negative obj indices) fixed up once the sizes of the chunks before it
+// are known. The meshes are then built per material, again a chunk per thread, with unindexed vertices like assimp's
+// obj importer makes, so the native post processing steps can take over from there
+
+static const size_t minChunkSize = 1 << 20;
+static const int chunksPerThread = 4;	// more chunks than threads, so a chunk full of faces does not hold up the rest
+
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+static inline void skipSpaces(const char* &p, const char* end)
+{
+	while (p < end && isSpace(*p))
+		p++;
+}
+
+static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+//parses a decimal number without going through the locale like strtod. The digits are gathered as an integer and scaled
+//once, which is exact for the up to 15 significant digits obj exporters write
+static bool parseFloat(const char* &p, const char* end, float &value)
+{
+	skipSpaces(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	for (; p < end && isDigit(*p); p++)
+	{
+		any = true;
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa > 0;
+		}
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && isDigit(*p); p++)
+		{
+			any = true;
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa > 0;
+				exponent--;
+			}
+		}
+	}
+	if (!any)
+		return false;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* e = p + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+'))
+			negativeExponent = *e++ == '-';
+		if (e < end && isDigit(*e))
+		{
+			int n = 0;
+			for (; e < end && isDigit(*e); e++)
+				n = std::min(n * 10 + (*e - '0'), 1000);
+			exponent += negativeExponent ? -n : n;
+			p = e;
+		}
+	}
+	double result = (double)mantissa;
+	if (mantissa == 0)
+		result = 0;
+	else if (exponent >= 0 && exponent <= 22)
+		result *= powersOf10[exponent];
+	else if (exponent < 0 && exponent >= -22)
+		result /= powersOf10[-exponent];
+	else
+		result *= pow(10.0, exponent);
+	value = (float)(negative ? -result : result);
+	return true;
+}
+
+static bool parseInt(const char* &p, const char* end, int &value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	if (p >= end || !isDigit(*p))
+		return false;
+	long long n = 0;
+	for (; p < end && isDigit(*p); p++)
+		n = std::min(n * 10 + (*p - '0'), 0x7fffffffLL);
+	value = (int)(negative ? -n : n);
+	return true;
+}
+
+//the rest of the line without the spaces around it, for names
+static std::string restOfLine(const char* p, const char* end)
+{
+	skipSpaces(p, end);
+	while (end > p && isSpace(end[-1]))
+		end--;
+	return std::string(p, end);
+}
+
+static bool startsWith(const char* p, const char* end, const char* keyword)
+{
+	size_t len = strlen(keyword);
+	return (size_t)(end - p) > len && memcmp(p, keyword, len) == 0 && isSpace(p[len]);
+}
+
+
+//indices of a corner that count back from the end of the chunk can be negative until the base is added, so whether a
+//corner has a texcoord or normal is kept in its flags
+struct Corner
+{
+	int position;
+	int texcoord;
+	int normal;
+};
+
+enum CornerFlags
+{
+	RelativePosition = 1,
+	RelativeTexcoord = 2,
+	RelativeNormal = 4,
+	HasTexcoord = 8,
+	HasNormal = 16,
+};
+
+struct ObjChunk
+{
+	const char* begin;
+	const char* end;
+	std::vector<aiVector3D> positions;
+	std::vector<aiVector3D> texcoords;
+	std::vector<aiVector3D> normals;
+	std::vector<Corner> corners;
+	std::vector<unsigned char> cornerFlags;	// per corner, CornerFlags
+	std::vector<unsigned int> faceSizes;
+	std::vector<std::pair<size_t, std::string> > materials;	// usemtl, with the face it starts at
+	std::string materialLibrary;
+	std::string error;
+
+	size_t positionBase, texcoordBase, normalBase;	// counts of the chunks before this one
+	int startMaterial;
+	std::vector<int> materialIds;	// of the usemtl names
+	std::vector<size_t> triangles;	// per material
+	std::vector<size_t> firstTriangle;	// per material, where the triangles of this chunk go in the mesh
+	std::vector<bool> texcoordsUsed;	// per material
+	std::vector<bool> normalsUsed;
+
+	ObjChunk(const char* begin, const char* end) : begin(begin), end(end), positionBase(0), texcoordBase(0), normalBase(0), startMaterial(0) {}
+};
+
+//indices count from 1, negative ones back from the last vertex read so far. Those are stored relative to this chunk,
+//and flagged so they get the base of the chunk added later
+static bool parseIndex(const char* &p, const char* end, size_t count, int &index, unsigned char &flags, unsigned char relative)
+{
+	int value;
+	if (!parseInt(p, end, value) || value == 0)
+		return false;
+	if (value > 0)
+		index = value - 1;
+	else
+	{
+		index = (int)count + value;
+		flags |= relative;
+	}
+	return true;
+}
+
+static void parseFace(ObjChunk &chunk, const char* p, const char* end)
+{
+	unsigned int size = 0;
+	while (true)
+	{
+		skipSpaces(p, end);
+		if (p >= end)
+			break;
+		Corner corner = { 0, 0, 0 };
+		unsigned char flags = 0;
+		if (!parseIndex(p, end, chunk.positions.size(), corner.position, flags, RelativePosition))
+		{
+			chunk.error = "invalid face";
+			return;
+		}
+		if (p < end && *p == '/')
+		{
+			p++;
+			if (p < end && *p != '/')
+			{
+				if (!parseIndex(p, end, chunk.texcoords.size(), corner.texcoord, flags, RelativeTexcoord))
+				{
+					chunk.error = "invalid texture coordinate index";
+					return;
+				}
+				flags |= HasTexcoord;
+			}
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (!parseIndex(p, end, chunk.normals.size(), corner.normal, flags, RelativeNormal))
+				{
+					chunk.error = "invalid normal index";
+					return;
+				}
+				flags |= HasNormal;
+			}
+		}
+		chunk.corners.push_back(corner);
+		chunk.cornerFlags.push_back(flags);
+		size++;
+	}
+	chunk.faceSizes.push_back(size);
+}
+
+static void parseChunk(ObjChunk &chunk)
+{
+	TRACE_SCOPE("parse obj chunk");
+	const char* p = chunk.begin;
+	while (p < chunk.end && chunk.error.empty())
+	{
+		const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+		if (!lineEnd)
+			lineEnd = chunk.end;
+		skipSpaces(p, lineEnd);
+		if (p + 1 < lineEnd)
+		{
+			float x = 0, y = 0, z = 0; // aiVector3D is packed, so its members can't be parsed into directly
+			if (p[0] == 'v' && isSpace(p[1]))
+			{
+				p += 2;
+				if (!parseFloat(p, lineEnd, x) || !parseFloat(p, lineEnd, y) || !parseFloat(p, lineEnd, z))
+					chunk.error = "invalid vertex position";
+				chunk.positions.push_back(aiVector3D(x, y, z));
+			}
+			else if (p[0] == 'v' && p[1] == 't' && p + 2 < lineEnd && isSpace(p[2]))
+			{
+				p += 3;
+				if (!parseFloat(p, lineEnd, x))
+					chunk.error = "invalid texture coordinate";
+				parseFloat(p, lineEnd, y);
+				chunk.texcoords.push_back(aiVector3D(x, y, 0));
+			}
+			else if (p[0] == 'v' && p[1] == 'n' && p + 2 < lineEnd && isSpace(p[2]))
+			{
+				p += 3;
+				if (!parseFloat(p, lineEnd, x) || !parseFloat(p, lineEnd, y) || !parseFloat(p, lineEnd, z))
+					chunk.error = "invalid normal";
+				chunk.normals.push_back(aiVector3D(x, y, z));
+			}
+			else if (p[0] == 'f' && isSpace(p[1]))
+				parseFace(chunk, p + 2, lineEnd);
+			else if (startsWith(p, lineEnd, "usemtl"))
+				chunk.materials.push_back(std::make_pair(chunk.faceSizes.size(), restOfLine(p + 6, lineEnd)));
+			else if (startsWith(p, lineEnd, "mtllib") && chunk.materialLibrary.empty())
+				chunk.materialLibrary = restOfLine(p + 6, lineEnd);
+			//comments, groups, objects, smoothing groups, points and lines are skipped
+		}
+		p = lineEnd + 1;
+	}
+}
+
+
+struct ObjMaterial
+{
+	std::string name;
+	aiColor3D diffuse, ambient, specular, emissive;
+	float shininess;
+	float opacity;
+	std::string texture;
+
+	ObjMaterial(const std::string &name) : name(name), diffuse(0.6f, 0.6f, 0.6f), ambient(0, 0, 0), specular(0, 0, 0), emissive(0, 0, 0), shininess(0), opacity(1) {}
+};
+
+static bool parseColor(const char* p, const char* end, aiColor3D &color)
+{
+	float r, g, b;
+	if (!parseFloat(p, end, r) || !parseFloat(p, end, g) || !parseFloat(p, end, b))
+		return false;
+	color = aiColor3D(r, g, b);
+	return true;
+}
+
+static void readMaterialLibrary(const std::string &filename, std::vector<ObjMaterial> &materials)
+{
+	TRACE_SCOPE("read mtl");
+	std::ifstream file(filename.c_str(), std::ios_base::binary);
+	if (!file.is_open())
+	{
+		LOG(Warning) << "Could not open material library " << filename;
+		return;
+	}
+	std::string line;
+	while (std::getline(file, line))
+	{
+		const char* p = line.c_str();
+		const char* end = p + line.size();
+		skipSpaces(p, end);
+		if (startsWith(p, end, "newmtl"))
+			materials.push_back(ObjMaterial(restOfLine(p + 6, end)));
+		else if (materials.empty())
+			continue;
+		else if (startsWith(p, end, "Kd"))
+			parseColor(p + 2, end, materials.back().diffuse);
+		else if (startsWith(p, end, "Ka"))
+			parseColor(p + 2, end, materials.back().ambient);
+		else if (startsWith(p, end, "Ks"))
+			parseColor(p + 2, end, materials.back().specular);
+		else if (startsWith(p, end, "Ke"))
+			parseColor(p + 2, end, materials.back().emissive);
+		else if (startsWith(p, end, "Ns"))
+			parseFloat(p += 2, end, materials.back().shininess);
+		else if (startsWith(p, end, "d"))
+			parseFloat(p += 1, end, materials.back().opacity);
+		else if (startsWith(p, end, "Tr") && parseFloat(p += 2, end, materials.back().opacity))
+			materials.back().opacity = 1 - materials.back().opacity;
+		else if (startsWith(p, end, "map_Kd"))
+		{
+			//options like -s 1 1 1 come before the filename
+			std::string value = restOfLine(p + 6, end);
+			size_t space = value.find_last_of(" \t");
+			materials.back().texture = space == std::string::npos ? value : value.substr(space + 1);
+		}
+	}
+}
+
+static aiMaterial* makeMaterial(const ObjMaterial &material)
+{
+	aiMaterial* ret = new aiMaterial();
+	aiString name(material.name);
+	ret->AddProperty(&name, AI_MATKEY_NAME);
+	int shading = aiShadingMode_Gouraud;
+	ret->AddProperty(&shading, 1, AI_MATKEY_SHADING_MODEL);
+	ret->AddProperty(&material.diffuse, 1, AI_MATKEY_COLOR_DIFFUSE);
+	ret->AddProperty(&material.ambient, 1, AI_MATKEY_COLOR_AMBIENT);
+	ret->AddProperty(&material.specular, 1, AI_MATKEY_COLOR_SPECULAR);
+	ret->AddProperty(&material.emissive, 1, AI_MATKEY_COLOR_EMISSIVE);
+	ret->AddProperty(&material.shininess, 1, AI_MATKEY_SHININESS);
+	ret->AddProperty(&material.opacity, 1, AI_MATKEY_OPACITY);
+	if (!material.texture.empty())
+	{
+		aiString texture(material.texture);
+		ret->AddProperty(&texture, AI_MATKEY_TEXTURE_DIFFUSE(0));
+	}
+	return ret;
+}
+
+
+struct ObjMesh
+{
+	aiMesh* mesh;
+	size_t triangles;
+	bool texcoords;
+	bool normals;
+};
+
+template<class F>
+static void forEachChunk(std::vector<ObjChunk> &chunks, int threads, const F &function)
+{
+	ThreadPool pool(threads);
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		ObjChunk* chunk = &chunks[i];
+		pool.addJob([chunk, &function]()
+		{
+			if (!progress.isCancelled())
+				function(*chunk);
+		});
+	}
+	pool.waitForJobs();
+}
+
+//the faces of a chunk, with the material they use
+template<class F>
+static void forEachFace(const ObjChunk &chunk, const F &function)
+{
+	int material = chunk.startMaterial;
+	size_t materialChange = 0;
+	size_t corner = 0;
+	for (size_t face = 0; face < chunk.faceSizes.size(); face++)
+	{
+		while (materialChange < chunk.materials.size() && chunk.materials[materialChange].first == face)
+			material = chunk.materialIds[materialChange++];
+		function(material, &chunk.corners[corner], &chunk.cornerFlags[corner], chunk.faceSizes[face]);
+		corner += chunk.faceSizes[face];
+	}
+}
+
+static void countTriangles(ObjChunk &chunk, size_t materialCount)
+{
+	chunk.triangles.assign(materialCount, 0);
+	chunk.texcoordsUsed.assign(materialCount, false);
+	chunk.normalsUsed.assign(materialCount, false);
+	forEachFace(chunk, [&chunk](int material, const Corner*, const unsigned char* flags, unsigned int size)
+	{
+		if (size < 3)
+			return;
+		chunk.triangles[material] += size - 2;
+		if (flags[0] & HasTexcoord)
+			chunk.texcoordsUsed[material] = true;
+		if (flags[0] & HasNormal)
+			chunk.normalsUsed[material] = true;
+	});
+}
+
+//writes the triangles of a chunk into the meshes, fanning polygons like assimp's triangulation does
+static void buildChunk(ObjChunk &chunk, std::vector<ObjMesh> &meshes, const std::vector<aiVector3D> &positions, const std::vector<aiVector3D> &texcoords,
+	const std::vector<aiVector3D> &normals, unsigned int flags)
+{
+	TRACE_SCOPE("build obj meshes");
+	bool flatNormals = (flags & aiProcess_GenNormals) && !(flags & aiProcess_GenSmoothNormals);
+	bool flipWinding = (flags & aiProcess_FlipWindingOrder) != 0;
+	std::vector<size_t> next = chunk.firstTriangle;
+	forEachFace(chunk, [&](int material, const Corner* corners, const unsigned char* cornerFlags, unsigned int size)
+	{
+		ObjMesh &mesh = meshes[material];
+		for (unsigned int i = 1; i + 1 < size && chunk.error.empty(); i++)
+		{
+			size_t triangle = next[material]++;
+			unsigned int order[3] = { 0, i, i + 1 };
+			if (flipWinding)
+				std::swap(order[1], order[2]);
+			aiFace &face = mesh.mesh->mFaces[triangle];
+			face.mNumIndices = 3;
+			face.mIndices = new unsigned int[3];
+			for (int ii = 0; ii < 3; ii++)
+			{
+				unsigned int vertex = (unsigned int)(triangle * 3 + ii);
+				const Corner &corner = corners[order[ii]];
+				unsigned char flags = cornerFlags[order[ii]];
+				face.mIndices[ii] = vertex;
+
+				long long position = corner.position + (flags & RelativePosition ? (long long)chunk.positionBase : 0);
+				if (position < 0 || position >= (long long)positions.size())
+				{
+					chunk.error = "face uses a vertex that does not exist";
+					return;
+				}
+				mesh.mesh->mVertices[vertex] = positions[position];
+				if (mesh.texcoords && (flags & HasTexcoord))
+				{
+					long long texcoord = corner.texcoord + (flags & RelativeTexcoord ? (long long)chunk.texcoordBase : 0);
+					if (texcoord >= 0 && texcoord < (long long)texcoords.size())
+						mesh.mesh->mTextureCoords[0][vertex] = texcoords[texcoord];
+				}
+				if (mesh.normals && (flags & HasNormal))
+				{
+					long long normal = corner.normal + (flags & RelativeNormal ? (long long)chunk.normalBase : 0);
+					if (normal >= 0 && normal < (long long)normals.size())
+						mesh.mesh->mNormals[vertex] = normals[normal];
+				}
+			}
+
+			aiVector3D* v = &mesh.mesh->mVertices[triangle * 3];
+			if (flatNormals && !mesh.normals)
+			{
+				aiVector3D normal = ((v[1] - v[0]) ^ (v[2] - v[0])).Normalize();
+				for (int ii = 0; ii < 3; ii++)
+					mesh.mesh->mNormals[triangle * 3 + ii] = normal;
+			}
+			for (int ii = 0; ii < 3; ii++)
+			{
+				if (flags & aiProcess_MakeLeftHanded)
+				{
+					v[ii].z = -v[ii].z;
+					if (mesh.mesh->mNormals)
+						mesh.mesh->mNormals[triangle * 3 + ii].z = -mesh.mesh->mNormals[triangle * 3 + ii].z;
+				}
+				if ((flags & aiProcess_FlipUVs) && mesh.texcoords)
+					mesh.mesh->mTextureCoords[0][triangle * 3 + ii].y = 1 - mesh.mesh->mTextureCoords[0][triangle * 3 + ii].y;
+			}
+		}
+	});
+}
+
+template<class T>
+static void release(std::vector<T> &values)
+{
+	std::vector<T>().swap(values);
+}
+
+
+aiScene* readObjNative(const std::string &filename, unsigned int flags, int threads, std::string &error)
+{
+	MappedFile file;
+	{
+		TRACE_SCOPE("map file");
+		file.open(filename);
+	}
+	if (!file.data)
+	{
+		error = "Error opening file " + filename;
+		return NULL;
+	}
+
+	//chunks end after a line end, so no line is split between them
+	size_t threadCount = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+	size_t chunkSize = std::max(minChunkSize, file.size / (threadCount * chunksPerThread) + 1);
+	std::vector<ObjChunk> chunks;
+	for (const char* p = file.data; p < file.data + file.size; )
+	{
+		const char* end = file.data + file.size;
+		const char* chunkEnd = p + std::min(chunkSize, (size_t)(end - p));
+		const char* lineEnd = chunkEnd < end ? (const char*)memchr(chunkEnd, '\n', end - chunkEnd) : NULL;
+		chunkEnd = lineEnd ? lineEnd + 1 : (chunkEnd < end ? end : chunkEnd);
+		chunks.push_back(ObjChunk(p, chunkEnd));
+		p = chunkEnd;
+	}
+
+	forEachChunk(chunks, threads, [](ObjChunk &chunk) { parseChunk(chunk); });
+	if (!progress.update("import", 0.5f))
+		return NULL;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if (!chunks[i].error.empty())
+		{
+			error = filename + ": " + chunks[i].error;
+			return NULL;
+		}
+	}
+
+	std::vector<ObjMaterial> materials;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if (!chunks[i].materialLibrary.empty())
+		{
+			readMaterialLibrary(filename.substr(0, filename.find_last_of("/\\") + 1) + chunks[i].materialLibrary, materials);
+			break;
+		}
+	}
+	//faces before the first usemtl get a default material, like in assimp
+	std::map<std::string, int> materialIndices;
+	for (size_t i = 0; i < materials.size(); i++)
+		materialIndices.insert(std::make_pair(materials[i].name, (int)i));
+	materials.push_back(ObjMaterial("DefaultMaterial"));
+	int material = (int)materials.size() - 1;
+
+	size_t positionCount = 0, texcoordCount = 0, normalCount = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		ObjChunk &chunk = chunks[i];
+		chunk.positionBase = positionCount;
+		chunk.texcoordBase = texcoordCount;
+		chunk.normalBase = normalCount;
+		positionCount += chunk.positions.size();
+		texcoordCount += chunk.texcoords.size();
+		normalCount += chunk.normals.size();
+		chunk.startMaterial = material;
+		for (size_t ii = 0; ii < chunk.materials.size(); ii++)
+		{
+			std::map<std::string, int>::iterator it = materialIndices.find(chunk.materials[ii].second);
+			if (it == materialIndices.end())
+			{
+				LOG(Warning) << "Material " << chunk.materials[ii].second << " is not in the material library, using the default material";
+				it = materialIndices.insert(std::make_pair(chunk.materials[ii].second, (int)materials.size() - 1)).first;
+			}
+			material = it->second;
+			chunk.materialIds.push_back(material);
+		}
+	}
+
+	std::vector<aiVector3D> positions(positionCount);
+	std::vector<aiVector3D> texcoords(texcoordCount);
+	std::vector<aiVector3D> normals(normalCount);
+	forEachChunk(chunks, threads, [&positions, &texcoords, &normals, &materials](ObjChunk &chunk)
+	{
+		TRACE_SCOPE("merge obj chunks");
+		std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + chunk.texcoordBase);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase);
+		release(chunk.positions);
+		release(chunk.texcoords);
+		release(chunk.normals);
+		countTriangles(chunk, materials.size());
+	});
+
+	//a mesh per material, every chunk writes its triangles to its own range of them
+	std::vector<ObjMesh> meshes(materials.size());
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		ObjMesh &mesh = meshes[i];
+		mesh.mesh = NULL;
+		mesh.triangles = 0;
+		mesh.texcoords = mesh.normals = false;
+		for (size_t ii = 0; ii < chunks.size(); ii++)
+		{
+			chunks[ii].firstTriangle.push_back(mesh.triangles);
+			mesh.triangles += chunks[ii].triangles[i];
+			mesh.texcoords = mesh.texcoords || chunks[ii].texcoordsUsed[i];
+			mesh.normals = mesh.normals || chunks[ii].normalsUsed[i];
+		}
+		if (mesh.triangles * 3 > 0xffffffffULL)
+		{
+			error = filename + ": material " + materials[i].name + " has too many triangles for one mesh";
+			return NULL;
+		}
+	}
+
+	aiScene* scene = new aiScene();
+	std::vector<unsigned int> meshIndices;
+	{
+		TRACE_SCOPE("allocate obj meshes");
+		ThreadPool pool(threads);
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].triangles == 0)
+				continue;
+			ObjMesh &mesh = meshes[i];
+			mesh.mesh = new aiMesh();
+			mesh.mesh->mName = aiString(materials[i].name);
+			mesh.mesh->mMaterialIndex = (unsigned int)i;
+			mesh.mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+			meshIndices.push_back((unsigned int)i);
+			pool.addJob([&mesh, flags]()
+			{
+				unsigned int vertices = (unsigned int)(mesh.triangles * 3);
+				mesh.mesh->mNumVertices = vertices;
+				mesh.mesh->mVertices = new aiVector3D[vertices];
+				if (mesh.normals || ((flags & aiProcess_GenNormals) && !(flags & aiProcess_GenSmoothNormals)))
+					mesh.mesh->mNormals = new aiVector3D[vertices];
+				if (mesh.texcoords)
+				{
+					mesh.mesh->mTextureCoords[0] = new aiVector3D[vertices];
+					mesh.mesh->mNumUVComponents[0] = 2;
+				}
+				mesh.mesh->mFaces = new aiFace[mesh.triangles];
+				mesh.mesh->mNumFaces = (unsigned int)mesh.triangles;
+			});
+		}
+		pool.waitForJobs();
+	}
+	if (meshIndices.empty())
+	{
+		delete scene;
+		error = filename + ": there are no faces";
+		return NULL;
+	}
+
+	scene->mMaterials = new aiMaterial*[materials.size()];
+	scene->mNumMaterials = (unsigned int)materials.size();
+	for (size_t i = 0; i < materials.size(); i++)
+		scene->mMaterials[i] = makeMaterial(materials[i]);
+	scene->mMeshes = new aiMesh*[meshIndices.size()];
+	scene->mNumMeshes = (unsigned int)meshIndices.size();
+	scene->mRootNode = new aiNode();
+	scene->mRootNode->mName = aiString(filename.substr(filename.find_last_of("/\\") + 1));
+	scene->mRootNode->mMeshes = new unsigned int[meshIndices.size()];
+	scene->mRootNode->mNumMeshes = (unsigned int)meshIndices.size();
+	for (size_t i = 0; i < meshIndices.size(); i++)
+	{
+		scene->mMeshes[i] = meshes[meshIndices[i]].mesh;
+		scene->mRootNode->mMeshes[i] = (unsigned int)i;
+	}
+
+	forEachChunk(chunks, threads, [&meshes, &positions, &texcoords, &normals, flags](ObjChunk &chunk) { buildChunk(chunk, meshes, positions, texcoords, normals, flags); });
+	for (size_t i = 0; i < chunks.size() && error.empty(); i++)
+		if (!chunks[i].error.empty())
+			error = filename + ": " + chunks[i].error;
+	if (!error.empty() || !progress.update("import", 1))
+	{
+		delete scene;
+		return NULL;
+	}
+	return scene;
+}
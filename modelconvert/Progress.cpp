@@ -0,0 +1,92 @@
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+
+#include <blib/json.h>
+
+#include "Progress.h"
+#include "Logger.h"
+
+Progress progress;
+
+
+Progress::Progress() : out(NULL), hasDeadline(false), deadline(0), cancelled(false)
+{
+}
+
+bool Progress::open(const std::string &filename)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (filename == "-")
+	{
+		out = &std::cerr;
+		return true;
+	}
+	//appended, as the processes of a scheduled batch all write to the same file
+	file.open(filename.c_str(), std::ios_base::out | std::ios_base::app);
+	out = file.is_open() ? &file : NULL;
+	return out != NULL;
+}
+
+void Progress::begin(const std::string &filename, int timeout)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->filename = filename;
+		start = std::chrono::steady_clock::now();
+		deadline = (start + std::chrono::seconds(timeout)).time_since_epoch().count();
+		hasDeadline = timeout > 0;
+		cancelled = false;
+		stage = "";
+	}
+	update("start", 0);
+}
+
+bool Progress::isCancelled()
+{
+	if (!cancelled && hasDeadline && std::chrono::steady_clock::now().time_since_epoch().count() > deadline)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!cancelled)
+		{
+			cancelled = true;
+			LOG(Warning) << "Conversion of " << filename << " passed its deadline, cancelling";
+			write(stage, -1, ",\"cancelled\":true");
+		}
+	}
+	return cancelled;
+}
+
+bool Progress::update(const std::string &stage, float fraction)
+{
+	if (isCancelled())
+		return false;
+	std::lock_guard<std::mutex> lock(mutex);
+	//assimp can call this very often, so within a stage only write a few times a second
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (stage == this->stage && fraction < 1 && now - lastWrite < std::chrono::milliseconds(200))
+		return true;
+	this->stage = stage;
+	lastWrite = now;
+	write(stage, fraction, "");
+	return true;
+}
+
+void Progress::end(bool success)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	write(cancelled ? stage : "done", success ? 1.0f : -1.0f, success ? ",\"success\":true" : cancelled ? ",\"success\":false,\"cancelled\":true" : ",\"success\":false");
+	hasDeadline = false;
+}
+
+//call with the mutex locked
+void Progress::write(const std::string &stage, float fraction, const char* extra)
+{
+	if (!out)
+		return;
+	float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	std::ostringstream line;
+	line << "{\"file\":" << blib::json::Value(filename) << ",\"stage\":" << blib::json::Value(stage) << ",\"progress\":" << fraction << ",\"elapsed\":" << elapsed << extra << "}";
+	*out << line.str() << std::endl;
+}
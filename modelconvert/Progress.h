@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// Keeps track of the conversion that is running, writes its progress as json lines for build dashboards and cancels it
+// when it runs past its deadline. The converters call update between their stages and stop when it returns false
+class Progress
+{
+	std::mutex mutex;
+	std::ofstream file;
+	std::ostream* out;
+	std::string filename;
+	std::string stage;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point lastWrite;
+	//read without the mutex by every thread that checks for cancellation
+	std::atomic<bool> hasDeadline;
+	std::atomic<std::chrono::steady_clock::rep> deadline;
+	std::atomic<bool> cancelled;
+
+	void write(const std::string &stage, float fraction, const char* extra);
+public:
+	Progress();
+
+	// filename "-" writes to stderr, as stdout has the log
+	bool open(const std::string &filename);
+	void begin(const std::string &filename, int timeout);
+	// fraction is between 0 and 1, or -1 when it is not known. Returns false when the conversion has to stop
+	bool update(const std::string &stage, float fraction = -1);
+	bool isCancelled();
+	void end(bool success);
+};
+
+extern Progress progress;
@@ -0,0 +1,596 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <blib/util/FileSystem.h>
+
+#include <assimp/Importer.hpp>
+#include <assimp/ProgressHandler.hpp>
+#include <assimp/scene.h>
+#include <assimp/version.h>
+
+#include "SceneImport.h"
+#include "ModelConvert.h"
+#include "Cache.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "Logger.h"
+
+// Snapshots only hold what a post processed scene needs for conversion: nodes, meshes with their bones, materials and
+// animations. Arrays are written as raw memory, so a snapshot is only valid for the same build of the converter,
+// which is checked with the sizes in the header
+#define SNAPSHOT_VERSION 1
+
+struct SnapshotHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned int keySize;	// sizeof(aiVectorKey)
+	unsigned int quatKeySize;	// sizeof(aiQuatKey)
+	unsigned int vectorSize;	// sizeof(aiVector3D)
+};
+
+
+template<class T>
+static void write(std::ostream &out, const T &value)
+{
+	out.write((const char*)&value, sizeof(T));
+}
+
+template<class T>
+static void writeArray(std::ostream &out, const T* values, unsigned int count)
+{
+	if (count > 0)
+		out.write((const char*)values, sizeof(T) * count);
+}
+
+static void writeString(std::ostream &out, const aiString &str)
+{
+	write(out, (unsigned int)str.length);
+	out.write(str.data, str.length);
+}
+
+static void writeNode(std::ostream &out, const aiNode* node)
+{
+	writeString(out, node->mName);
+	write(out, node->mTransformation);
+	write(out, node->mNumMeshes);
+	writeArray(out, node->mMeshes, node->mNumMeshes);
+	write(out, node->mNumChildren);
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+		writeNode(out, node->mChildren[i]);
+}
+
+static void writeMesh(std::ostream &out, const aiMesh* mesh)
+{
+	writeString(out, mesh->mName);
+	write(out, mesh->mPrimitiveTypes);
+	write(out, mesh->mMaterialIndex);
+	write(out, mesh->mNumVertices);
+	writeArray(out, mesh->mVertices, mesh->mNumVertices);
+	write(out, mesh->HasNormals());
+	writeArray(out, mesh->mNormals, mesh->HasNormals() ? mesh->mNumVertices : 0);
+	write(out, mesh->HasTangentsAndBitangents());
+	writeArray(out, mesh->mTangents, mesh->HasTangentsAndBitangents() ? mesh->mNumVertices : 0);
+	writeArray(out, mesh->mBitangents, mesh->HasTangentsAndBitangents() ? mesh->mNumVertices : 0);
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++)
+	{
+		write(out, mesh->HasVertexColors(i));
+		writeArray(out, mesh->mColors[i], mesh->HasVertexColors(i) ? mesh->mNumVertices : 0);
+	}
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+	{
+		write(out, mesh->HasTextureCoords(i));
+		write(out, mesh->mNumUVComponents[i]);
+		writeArray(out, mesh->mTextureCoords[i], mesh->HasTextureCoords(i) ? mesh->mNumVertices : 0);
+	}
+
+	write(out, mesh->mNumFaces);
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		write(out, mesh->mFaces[i].mNumIndices);
+		writeArray(out, mesh->mFaces[i].mIndices, mesh->mFaces[i].mNumIndices);
+	}
+
+	write(out, mesh->mNumBones);
+	for (unsigned int i = 0; i < mesh->mNumBones; i++)
+	{
+		writeString(out, mesh->mBones[i]->mName);
+		write(out, mesh->mBones[i]->mOffsetMatrix);
+		write(out, mesh->mBones[i]->mNumWeights);
+		writeArray(out, mesh->mBones[i]->mWeights, mesh->mBones[i]->mNumWeights);
+	}
+}
+
+static void writeMaterial(std::ostream &out, const aiMaterial* material)
+{
+	write(out, material->mNumProperties);
+	for (unsigned int i = 0; i < material->mNumProperties; i++)
+	{
+		const aiMaterialProperty* prop = material->mProperties[i];
+		writeString(out, prop->mKey);
+		write(out, prop->mSemantic);
+		write(out, prop->mIndex);
+		write(out, (unsigned int)prop->mType);
+		write(out, prop->mDataLength);
+		writeArray(out, prop->mData, prop->mDataLength);
+	}
+}
+
+static void writeAnimation(std::ostream &out, const aiAnimation* animation)
+{
+	writeString(out, animation->mName);
+	write(out, animation->mDuration);
+	write(out, animation->mTicksPerSecond);
+	write(out, animation->mNumChannels);
+	for (unsigned int i = 0; i < animation->mNumChannels; i++)
+	{
+		const aiNodeAnim* channel = animation->mChannels[i];
+		writeString(out, channel->mNodeName);
+		write(out, (unsigned int)channel->mPreState);
+		write(out, (unsigned int)channel->mPostState);
+		write(out, channel->mNumPositionKeys);
+		writeArray(out, channel->mPositionKeys, channel->mNumPositionKeys);
+		write(out, channel->mNumRotationKeys);
+		writeArray(out, channel->mRotationKeys, channel->mNumRotationKeys);
+		write(out, channel->mNumScalingKeys);
+		writeArray(out, channel->mScalingKeys, channel->mNumScalingKeys);
+	}
+}
+
+static bool saveSnapshot(const aiScene* scene, const std::string &filename)
+{
+	//written to a temporary file first, so a crash halfway never leaves a broken snapshot that looks valid
+	std::ofstream out((filename + ".tmp").c_str(), std::ios_base::binary | std::ios_base::out);
+	if (!out.is_open())
+		return false;
+
+	SnapshotHeader header;
+	memcpy(header.magic, "MCSS", 4);
+	header.version = SNAPSHOT_VERSION;
+	header.keySize = sizeof(aiVectorKey);
+	header.quatKeySize = sizeof(aiQuatKey);
+	header.vectorSize = sizeof(aiVector3D);
+	write(out, header);
+
+	write(out, scene->mFlags);
+	writeNode(out, scene->mRootNode);
+	write(out, scene->mNumMeshes);
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+		writeMesh(out, scene->mMeshes[i]);
+	write(out, scene->mNumMaterials);
+	for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+		writeMaterial(out, scene->mMaterials[i]);
+	write(out, scene->mNumAnimations);
+	for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+		writeAnimation(out, scene->mAnimations[i]);
+	out.close();
+	if (!out)
+		return false;
+
+	remove(filename.c_str());
+	return rename((filename + ".tmp").c_str(), filename.c_str()) == 0;
+}
+
+
+//reads from a snapshot in memory. Reading past the end sets failed and returns zeroes, so a broken file
+//still builds a consistent scene that can be deleted
+class SnapshotReader
+{
+	const std::string &data;
+	size_t pos;
+public:
+	bool failed;
+
+	SnapshotReader(const std::string &data) : data(data), pos(0), failed(false)
+	{
+	}
+
+	template<class T>
+	T read()
+	{
+		T value;
+		readInto(&value, 1);
+		return value;
+	}
+
+	template<class T>
+	void readInto(T* values, unsigned int count)
+	{
+		size_t len = sizeof(T) * count;
+		if (failed || len > data.size() - pos)
+		{
+			failed = true;
+			memset((void*)values, 0, len);
+			return;
+		}
+		memcpy((void*)values, data.c_str() + pos, len);
+		pos += len;
+	}
+
+	//counts are checked against the remaining data before allocating, so a broken count can't allocate gigabytes
+	template<class T>
+	T* readArray(unsigned int count)
+	{
+		if (count == 0)
+			return NULL;
+		if (failed || count > (data.size() - pos) / sizeof(T))
+		{
+			failed = true;
+			return NULL;
+		}
+		T* values = new T[count];
+		readInto(values, count);
+		return values;
+	}
+
+	aiString readString()
+	{
+		aiString str;
+		unsigned int len = read<unsigned int>();
+		if (len >= MAXLEN || len > data.size() - pos)
+		{
+			failed = true;
+			return str;
+		}
+		str.Set(data.substr(pos, len));
+		pos += len;
+		return str;
+	}
+
+	unsigned int readCount()
+	{
+		unsigned int count = read<unsigned int>();
+		if (count > data.size() - pos)
+		{
+			failed = true;
+			return 0;
+		}
+		return count;
+	}
+};
+
+static aiNode* readNode(SnapshotReader &in, aiNode* parent)
+{
+	aiNode* node = new aiNode();
+	node->mParent = parent;
+	node->mName = in.readString();
+	node->mTransformation = in.read<aiMatrix4x4>();
+	unsigned int numMeshes = in.readCount();
+	node->mMeshes = in.readArray<unsigned int>(numMeshes);
+	node->mNumMeshes = node->mMeshes ? numMeshes : 0;
+	unsigned int numChildren = in.readCount();
+	if (numChildren > 0)
+	{
+		node->mChildren = new aiNode*[numChildren]();
+		node->mNumChildren = numChildren;
+		for (unsigned int i = 0; i < numChildren && !in.failed; i++)
+			node->mChildren[i] = readNode(in, node);
+	}
+	return node;
+}
+
+static aiMesh* readMesh(SnapshotReader &in)
+{
+	aiMesh* mesh = new aiMesh();
+	mesh->mName = in.readString();
+	mesh->mPrimitiveTypes = in.read<unsigned int>();
+	mesh->mMaterialIndex = in.read<unsigned int>();
+	mesh->mNumVertices = in.readCount();
+	mesh->mVertices = in.readArray<aiVector3D>(mesh->mNumVertices);
+	if (in.read<bool>())
+		mesh->mNormals = in.readArray<aiVector3D>(mesh->mNumVertices);
+	if (in.read<bool>())
+	{
+		mesh->mTangents = in.readArray<aiVector3D>(mesh->mNumVertices);
+		mesh->mBitangents = in.readArray<aiVector3D>(mesh->mNumVertices);
+	}
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++)
+		if (in.read<bool>())
+			mesh->mColors[i] = in.readArray<aiColor4D>(mesh->mNumVertices);
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+	{
+		bool hasTexCoords = in.read<bool>();
+		mesh->mNumUVComponents[i] = in.read<unsigned int>();
+		if (hasTexCoords)
+			mesh->mTextureCoords[i] = in.readArray<aiVector3D>(mesh->mNumVertices);
+	}
+	if (!mesh->mVertices)
+		mesh->mNumVertices = 0;
+
+	unsigned int numFaces = in.readCount();
+	if (numFaces > 0)
+	{
+		mesh->mFaces = new aiFace[numFaces];
+		mesh->mNumFaces = numFaces;
+		for (unsigned int i = 0; i < numFaces && !in.failed; i++)
+		{
+			unsigned int numIndices = in.readCount();
+			mesh->mFaces[i].mIndices = in.readArray<unsigned int>(numIndices);
+			mesh->mFaces[i].mNumIndices = mesh->mFaces[i].mIndices ? numIndices : 0;
+		}
+	}
+
+	unsigned int numBones = in.readCount();
+	if (numBones > 0)
+	{
+		mesh->mBones = new aiBone*[numBones]();
+		mesh->mNumBones = numBones;
+		for (unsigned int i = 0; i < numBones && !in.failed; i++)
+		{
+			aiBone* bone = new aiBone();
+			mesh->mBones[i] = bone;
+			bone->mName = in.readString();
+			bone->mOffsetMatrix = in.read<aiMatrix4x4>();
+			unsigned int numWeights = in.readCount();
+			bone->mWeights = in.readArray<aiVertexWeight>(numWeights);
+			bone->mNumWeights = bone->mWeights ? numWeights : 0;
+		}
+	}
+	return mesh;
+}
+
+static aiMaterial* readMaterial(SnapshotReader &in)
+{
+	aiMaterial* material = new aiMaterial();
+	unsigned int numProperties = in.readCount();
+	for (unsigned int i = 0; i < numProperties && !in.failed; i++)
+	{
+		aiString key = in.readString();
+		unsigned int semantic = in.read<unsigned int>();
+		unsigned int index = in.read<unsigned int>();
+		aiPropertyTypeInfo type = (aiPropertyTypeInfo)in.read<unsigned int>();
+		unsigned int length = in.readCount();
+		char* data = in.readArray<char>(length);
+		if (data)
+			material->AddBinaryProperty(data, length, key.C_Str(), semantic, index, type);
+		delete[] data;
+	}
+	return material;
+}
+
+static aiAnimation* readAnimation(SnapshotReader &in)
+{
+	aiAnimation* animation = new aiAnimation();
+	animation->mName = in.readString();
+	animation->mDuration = in.read<double>();
+	animation->mTicksPerSecond = in.read<double>();
+	unsigned int numChannels = in.readCount();
+	if (numChannels > 0)
+	{
+		animation->mChannels = new aiNodeAnim*[numChannels]();
+		animation->mNumChannels = numChannels;
+		for (unsigned int i = 0; i < numChannels && !in.failed; i++)
+		{
+			aiNodeAnim* channel = new aiNodeAnim();
+			animation->mChannels[i] = channel;
+			channel->mNodeName = in.readString();
+			channel->mPreState = (aiAnimBehaviour)in.read<unsigned int>();
+			channel->mPostState = (aiAnimBehaviour)in.read<unsigned int>();
+			unsigned int count = in.readCount();
+			channel->mPositionKeys = in.readArray<aiVectorKey>(count);
+			channel->mNumPositionKeys = channel->mPositionKeys ? count : 0;
+			count = in.readCount();
+			channel->mRotationKeys = in.readArray<aiQuatKey>(count);
+			channel->mNumRotationKeys = channel->mRotationKeys ? count : 0;
+			count = in.readCount();
+			channel->mScalingKeys = in.readArray<aiVectorKey>(count);
+			channel->mNumScalingKeys = channel->mScalingKeys ? count : 0;
+		}
+	}
+	return animation;
+}
+
+static aiScene* loadSnapshot(const std::string &filename)
+{
+	std::ifstream file(filename.c_str(), std::ios_base::binary | std::ios_base::in);
+	if (!file.is_open())
+		return NULL;
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	std::string data = buffer.str();
+	SnapshotReader in(data);
+
+	SnapshotHeader header = in.read<SnapshotHeader>();
+	if (in.failed || memcmp(header.magic, "MCSS", 4) != 0 || header.version != SNAPSHOT_VERSION ||
+		header.keySize != sizeof(aiVectorKey) || header.quatKeySize != sizeof(aiQuatKey) || header.vectorSize != sizeof(aiVector3D))
+		return NULL;
+
+	aiScene* scene = new aiScene();
+	scene->mFlags = in.read<unsigned int>();
+	scene->mRootNode = readNode(in, NULL);
+
+	unsigned int count = in.readCount();
+	if (count > 0)
+	{
+		scene->mMeshes = new aiMesh*[count]();
+		scene->mNumMeshes = count;
+		for (unsigned int i = 0; i < count && !in.failed; i++)
+			scene->mMeshes[i] = readMesh(in);
+	}
+	count = in.readCount();
+	if (count > 0)
+	{
+		scene->mMaterials = new aiMaterial*[count]();
+		scene->mNumMaterials = count;
+		for (unsigned int i = 0; i < count && !in.failed; i++)
+			scene->mMaterials[i] = readMaterial(in);
+	}
+	count = in.readCount();
+	if (count > 0)
+	{
+		scene->mAnimations = new aiAnimation*[count]();
+		scene->mNumAnimations = count;
+		for (unsigned int i = 0; i < count && !in.failed; i++)
+			scene->mAnimations[i] = readAnimation(in);
+	}
+
+	if (in.failed)
+	{
+		LOG(Warning) << "Scene snapshot " << filename << " is broken, importing again";
+		delete scene;
+		return NULL;
+	}
+	return scene;
+}
+
+
+//passes assimp's progress on, and stops the import when the conversion is cancelled
+class ImportProgress : public Assimp::ProgressHandler
+{
+public:
+	bool Update(float percentage)
+	{
+		return progress.update("import", percentage < 0 ? -1 : percentage / 100);
+	}
+};
+
+
+//importers are kept per thread after use, as creating one sets up all of assimp's importers and steps again.
+//A conversion of an animated model has two imports open at the same time, so there can be more than one
+struct ImporterPool
+{
+	std::vector<Assimp::Importer*> importers;
+	~ImporterPool()
+	{
+		for (size_t i = 0; i < importers.size(); i++)
+			delete importers[i];
+	}
+};
+static thread_local ImporterPool importerPool;
+
+static Assimp::Importer* takeImporter()
+{
+	if (importerPool.importers.empty())
+		return new Assimp::Importer();
+	Assimp::Importer* importer = importerPool.importers.back();
+	importerPool.importers.pop_back();
+	return importer;
+}
+
+void SceneImport::warmUp()
+{
+	while (importerPool.importers.size() < 2)
+		importerPool.importers.push_back(new Assimp::Importer());
+}
+
+
+//everything that changes the post processed scene, other than the model itself
+static std::string snapshotKey(const Options &options)
+{
+	std::ostringstream key;
+	key << "scene " << SNAPSHOT_VERSION << " assimp " << aiGetVersionMajor() << "." << aiGetVersionMinor() << "." << aiGetVersionRevision();
+	key << " flags " << options.importFlags << " native " << options.nativeSteps << " " << options.nativeObj;
+	return key.str();
+}
+
+
+SceneImport::SceneImport(const std::string &filename, const Options &options)
+{
+	importer = takeImporter();
+	ownScene = NULL;
+	scene = NULL;
+
+	std::string snapshotFile;
+	if (!options.sceneCacheDirectory.empty())
+	{
+#ifdef _WIN32
+		_mkdir(options.sceneCacheDirectory.c_str());
+#else
+		mkdir(options.sceneCacheDirectory.c_str(), 0755);
+#endif
+		std::string hash = inputHash(filename, snapshotKey(options));
+		if (!hash.empty())
+			snapshotFile = options.sceneCacheDirectory + "/" + hash + ".scene";
+	}
+	if (!snapshotFile.empty())
+	{
+		TRACE_SCOPE("load scene snapshot");
+		ownScene = loadSnapshot(snapshotFile);
+		if (ownScene)
+		{
+			LOG(Info) << "Loaded post processed scene from " << snapshotFile;
+			scene = ownScene;
+			return;
+		}
+	}
+
+	std::string hint = fileExtension(filename);
+	if (options.nativeObj && hint == ".obj")
+	{
+		{
+			TRACE_SCOPE("native obj import");
+			ownScene = readObjNative(filename, options.importFlags, options.threads, error);
+		}
+		if (ownScene && progress.update("native steps", 0))
+		{
+			processSceneNative(ownScene, options.importFlags, options.threads);
+			scene = ownScene;
+		}
+		if (progress.isCancelled())
+		{
+			error = "Cancelled, the conversion passed its deadline";
+			scene = NULL;
+		}
+		if (scene && !snapshotFile.empty())
+		{
+			TRACE_SCOPE("save scene snapshot");
+			if (!saveSnapshot(scene, snapshotFile))
+				LOG(Warning) << "Could not write scene snapshot " << snapshotFile;
+		}
+		return;
+	}
+
+	char* data;
+	int len;
+	{
+		TRACE_SCOPE("read file");
+		len = blib::util::FileSystem::getData(filename, data);
+	}
+	if (len == 0)
+	{
+		error = "Error opening file " + filename;
+		return;
+	}
+
+	importer->SetProgressHandler(new ImportProgress()); // the importer deletes it
+	if (options.nativeSteps)
+		scene = readFileNative(*importer, data, len, hint.c_str(), options.importFlags, options.threads);
+	else
+	{
+		//one scope for the import and all post processing, applying the steps separately would change the result
+		TRACE_SCOPE("assimp import");
+		scene = importer->ReadFileFromMemory(data, len, options.importFlags, hint.c_str());
+	}
+	delete[] data; // assimp is done with it when the import returns
+	if (!scene)
+	{
+		error = progress.isCancelled() ? "Cancelled, the conversion passed its deadline" : importer->GetErrorString();
+		return;
+	}
+
+	if (!snapshotFile.empty())
+	{
+		TRACE_SCOPE("save scene snapshot");
+		if (!saveSnapshot(scene, snapshotFile))
+			LOG(Warning) << "Could not write scene snapshot " << snapshotFile;
+	}
+}
+
+SceneImport::~SceneImport()
+{
+	delete ownScene;
+	importer->FreeScene();
+	importer->SetProgressHandler(NULL);
+	importerPool.importers.push_back(importer);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <assimp/Importer.hpp>
+
+struct aiScene;
+struct Options;
+
+// Imports a model through assimp with the post processing used for all conversions. When a scene cache directory is set,
+// the post processed scene is also stored as a binary snapshot, keyed by the input file and the import flags, and the next
+// import of the same file loads the snapshot instead of running assimp again. With the nativeObj option, obj files are
+// read without assimp. scene is NULL when the import failed
+class SceneImport
+{
+	Assimp::Importer* importer;
+	aiScene* ownScene;	// loaded from a snapshot or read by the native obj reader, instead of owned by the importer
+public:
+	const aiScene* scene;
+	std::string error;
+
+	SceneImport(const std::string &filename, const Options &options);
+	~SceneImport();
+
+	// creates the importers of this thread up front, so the first conversion does not pay for setting up assimp
+	static void warmUp();
+};
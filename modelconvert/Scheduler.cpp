@@ -0,0 +1,275 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+#endif
+
+#include <blib/json.h>
+
+#include "ModelConvert.h"
+#include "Logger.h"
+
+// Runs the conversions of a batch as separate processes, as many at once as fit in the memory budget. The peak memory
+// of a conversion is estimated from the file size, times the largest peak memory per input byte seen in earlier runs
+// for files of that format. The history of peaks is kept in options.memoryHistory
+
+static const long long baseMemory = 32 * 1024 * 1024;	// the converter itself, before loading a model
+static const int historySize = 20;						// ratios remembered per format
+
+struct ScheduledJob
+{
+	std::string filename;
+	std::string extension;
+	long long size;
+	long long estimate;
+#ifdef _WIN32
+	HANDLE process;
+#else
+	pid_t pid;
+#endif
+};
+
+//peak memory per input byte to assume for formats without history
+static double defaultRatio(const std::string &extension)
+{
+	if (extension == ".fbx")
+		return 40;
+	if (extension == ".dae")
+		return 25;
+	if (extension == ".obj" || extension == ".3ds")
+		return 15;
+	return 10;
+}
+
+static long long estimateMemory(const blib::json::Value &history, const std::string &extension, long long size)
+{
+	double ratio = defaultRatio(extension);
+	if (history.isMember(extension) && history[extension].size() > 0)
+	{
+		ratio = 0;
+		for (size_t i = 0; i < history[extension].size(); i++)
+			ratio = std::max(ratio, (double)history[extension][(int)i].asFloat());
+	}
+	return baseMemory + (long long)(size * ratio * 1.2); // some headroom, the history only knows the files seen so far
+}
+
+static blib::json::Value loadHistory(const std::string &filename)
+{
+	blib::json::Value history(blib::json::Type::objectValue);
+	std::ifstream file(filename.c_str());
+	if (file.is_open())
+	{
+		std::stringstream data;
+		data << file.rdbuf();
+		history = blib::json::readJson(data.str());
+		if (!history.isObject())
+			history = blib::json::Value(blib::json::Type::objectValue);
+	}
+	return history;
+}
+
+static void addToHistory(blib::json::Value &history, const ScheduledJob &job, long long peak)
+{
+	if (job.size <= 0 || peak <= baseMemory)
+		return;
+	blib::json::Value ratios(blib::json::Type::arrayValue);
+	if (history.isMember(job.extension))
+	{
+		size_t count = history[job.extension].size();
+		for (size_t i = count >= historySize ? count - historySize + 1 : 0; i < count; i++)
+			ratios.push_back(history[job.extension][(int)i]);
+	}
+	ratios.push_back((float)((peak - baseMemory) / (double)job.size));
+	history[job.extension] = ratios;
+}
+
+static std::string megabytes(long long bytes)
+{
+	return std::to_string(bytes / (1024 * 1024)) + " MB";
+}
+
+
+#ifdef _WIN32
+static bool startJob(ScheduledJob &job, const std::vector<std::string> &command)
+{
+	std::string commandLine;
+	for (size_t i = 0; i < command.size(); i++)
+		commandLine += "\"" + command[i] + "\" ";
+	commandLine += "\"" + job.filename + "\"";
+
+	STARTUPINFOA startupInfo;
+	PROCESS_INFORMATION processInfo;
+	ZeroMemory(&startupInfo, sizeof(startupInfo));
+	startupInfo.cb = sizeof(startupInfo);
+	std::vector<char> buf(commandLine.begin(), commandLine.end());
+	buf.push_back(0);
+	if (!CreateProcessA(NULL, &buf[0], NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &processInfo))
+		return false;
+	CloseHandle(processInfo.hThread);
+	job.process = processInfo.hProcess;
+	return true;
+}
+
+//waits for one of the running jobs to finish, returns its index
+static size_t waitForJob(std::vector<ScheduledJob> &running, long long &peak, bool &success)
+{
+	std::vector<HANDLE> handles;
+	for (size_t i = 0; i < running.size(); i++)
+		handles.push_back(running[i].process);
+	DWORD result = WaitForMultipleObjects((DWORD)handles.size(), &handles[0], FALSE, INFINITE);
+	size_t index = result - WAIT_OBJECT_0;
+	if (result < WAIT_OBJECT_0 || index >= running.size())
+		return (size_t)-1;
+
+	PROCESS_MEMORY_COUNTERS counters;
+	peak = GetProcessMemoryInfo(running[index].process, &counters, sizeof(counters)) ? (long long)counters.PeakWorkingSetSize : 0;
+	DWORD exitCode = 1;
+	GetExitCodeProcess(running[index].process, &exitCode);
+	success = exitCode == 0;
+	CloseHandle(running[index].process);
+	return index;
+}
+#else
+static bool startJob(ScheduledJob &job, const std::vector<std::string> &command)
+{
+	std::vector<char*> args;
+	for (size_t i = 0; i < command.size(); i++)
+		args.push_back((char*)command[i].c_str());
+	args.push_back((char*)job.filename.c_str());
+	args.push_back(NULL);
+
+	logger.flush(); // or the child prints what is still buffered again
+	fflush(stdout);
+	job.pid = fork();
+	if (job.pid == 0)
+	{
+		execvp(args[0], &args[0]);
+		_exit(127);
+	}
+	return job.pid > 0;
+}
+
+static size_t waitForJob(std::vector<ScheduledJob> &running, long long &peak, bool &success)
+{
+	while (true)
+	{
+		int status;
+		struct rusage usage;
+		pid_t pid = wait4(-1, &status, 0, &usage);
+		if (pid == -1 && errno == EINTR)
+			continue;
+		if (pid == -1)
+			return (size_t)-1;
+		for (size_t i = 0; i < running.size(); i++)
+		{
+			if (running[i].pid != pid)
+				continue;
+#ifdef __APPLE__
+			peak = usage.ru_maxrss;
+#else
+			peak = usage.ru_maxrss * 1024LL;
+#endif
+			success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			return i;
+		}
+	}
+}
+#endif
+
+
+int scheduleBatch(const std::vector<std::string> &command, const std::vector<std::string> &files, const Options &options)
+{
+	blib::json::Value history = loadHistory(options.memoryHistory);
+	long long budget = options.memoryBudget * 1024LL * 1024LL;
+	size_t maxJobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+#ifdef _WIN32
+	maxJobs = std::min(maxJobs, (size_t)MAXIMUM_WAIT_OBJECTS); // the most WaitForMultipleObjects can wait for
+#endif
+
+	std::vector<ScheduledJob> pending;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		ScheduledJob job;
+		job.filename = files[i];
+		job.extension = fileExtension(files[i]);
+		std::ifstream file(files[i].c_str(), std::ios_base::binary | std::ios_base::in | std::ios_base::ate);
+		job.size = file.is_open() ? (long long)file.tellg() : 0;
+		job.estimate = estimateMemory(history, job.extension, job.size);
+		pending.push_back(job);
+	}
+	//largest first, so a big model does not end up running alone at the end of the batch
+	std::stable_sort(pending.begin(), pending.end(), [](const ScheduledJob &a, const ScheduledJob &b) { return a.estimate > b.estimate; });
+
+	std::vector<ScheduledJob> running;
+	long long used = 0;
+	int failed = 0;
+	while (!pending.empty() || !running.empty())
+	{
+		//start the largest jobs that fit. A job that is over the budget on its own still runs, but only by itself
+		for (size_t i = 0; i < pending.size() && running.size() < maxJobs; )
+		{
+			if (budget > 0 && used + pending[i].estimate > budget && !running.empty())
+			{
+				i++;
+				continue;
+			}
+			ScheduledJob job = pending[i];
+			pending.erase(pending.begin() + i);
+			if (budget > 0 && job.estimate > budget)
+				LOG(Warning) << job.filename << " is estimated to need " << megabytes(job.estimate) << ", more than the memory budget";
+			if (!startJob(job, command))
+			{
+				LOG(Error) << "Could not start a conversion of " << job.filename;
+				failed++;
+				continue;
+			}
+			LOG(Info) << "Converting " << job.filename << ", estimated " << megabytes(job.estimate);
+			used += job.estimate;
+			running.push_back(job);
+		}
+
+		if (running.empty())
+			continue;
+		long long peak = 0;
+		bool success = false;
+		size_t index = waitForJob(running, peak, success);
+		if (index >= running.size())
+		{
+			//lost track of the children, the files that did not finish can't be counted as converted
+			LOG(Error) << "Could not wait for the running conversions, " << (int)(running.size() + pending.size()) << " files were not converted";
+			failed += (int)(running.size() + pending.size());
+			break;
+		}
+		ScheduledJob job = running[index];
+		running.erase(running.begin() + index);
+		used -= job.estimate;
+		LOG(Info) << "Finished " << job.filename << ", peak memory " << megabytes(peak) << ", estimated " << megabytes(job.estimate);
+		if (success)
+			addToHistory(history, job, peak);
+		else
+		{
+			LOG(Error) << "Could not convert " << job.filename;
+			failed++;
+		}
+	}
+
+	std::ofstream historyFile(options.memoryHistory.c_str());
+	historyFile << history;
+	printf("Converted %i of %i models\n", (int)files.size() - failed, (int)files.size());
+	return failed > 0 ? -1 : 0;
+}
@@ -0,0 +1,298 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <sstream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include <blib/json.h>
+
+#include <assimp/scene.h>
+
+#include "ModelConvert.h"
+#include "SceneImport.h"
+#include "Logger.h"
+
+// Reports what a model will cost without writing it: per mesh the vertices and triangles, how many vertices are exact
+// copies of another, and how well the triangle order uses the vertex cache, then the bone influences per vertex, the
+// keys of every animation channel, and an estimate of the output size per section. Assimp models are measured on the
+// post processed scene the converter would get, pmd and pmx models on the converter's own output
+
+static const int cacheSize = 12;	// the FIFO the cache locality step optimizes for
+static const int maxInfluences = 4;	// bone weights per vertex in the output, the rest are dropped
+
+struct MeshStats
+{
+	std::string name;
+	long long vertices;
+	long long triangles;
+	long long duplicates;	// vertices used by the mesh that have the same values as an earlier one
+	float acmr;				// cache misses per triangle, 0.5 is the best possible, 3 is no reuse at all
+	float atvr;				// cache misses per vertex, 1 is the best possible
+};
+
+struct SectionSizes
+{
+	std::map<std::string, long long> bytes;
+	void add(const std::string &section, long long size) { bytes[section] += size; }
+};
+
+//length of a number printed in the json output, with its separator
+static long long numberBytes(float value)
+{
+	char buf[32];
+	return snprintf(buf, sizeof(buf), "%g", value) + 1;
+}
+
+//vertices holds vertexSize floats per vertex, indices are the triangles in the order they are written
+static MeshStats meshStats(const std::string &name, const std::vector<float> &vertices, int vertexSize, const std::vector<unsigned int> &indices)
+{
+	MeshStats stats;
+	stats.name = name;
+	stats.triangles = indices.size() / 3;
+
+	std::unordered_map<unsigned int, int> stamps;
+	int time = 0;
+	int misses = 0;
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		std::unordered_map<unsigned int, int>::iterator it = stamps.find(indices[i]);
+		if (it == stamps.end() || time - it->second > cacheSize)
+		{
+			stamps[indices[i]] = time++;
+			misses++;
+		}
+	}
+	stats.vertices = stamps.size();
+	stats.acmr = stats.triangles > 0 ? misses / (float)stats.triangles : 0;
+	stats.atvr = stats.vertices > 0 ? misses / (float)stats.vertices : 0;
+
+	std::unordered_map<std::string, int> unique;
+	for (std::unordered_map<unsigned int, int>::iterator it = stamps.begin(); it != stamps.end(); it++)
+		if ((it->first + 1) * (size_t)vertexSize <= vertices.size())
+			unique[std::string((const char*)&vertices[it->first * vertexSize], vertexSize * sizeof(float))]++;
+	stats.duplicates = stats.vertices - unique.size();
+	return stats;
+}
+
+static void printMeshStats(const std::vector<MeshStats> &meshes)
+{
+	MeshStats total = { "total", 0, 0, 0, 0, 0 };
+	double misses = 0;
+	printf("%-24s %10s %10s %11s %7s %7s\n", "mesh", "vertices", "triangles", "duplicates", "acmr", "atvr");
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		const MeshStats &mesh = meshes[i];
+		printf("%-24s %10lld %10lld %10.1f%% %7.3f %7.3f\n", mesh.name.c_str(), mesh.vertices, mesh.triangles,
+			mesh.vertices > 0 ? 100.0 * mesh.duplicates / mesh.vertices : 0.0, mesh.acmr, mesh.atvr);
+		total.vertices += mesh.vertices;
+		total.triangles += mesh.triangles;
+		total.duplicates += mesh.duplicates;
+		misses += mesh.acmr * mesh.triangles;
+	}
+	printf("%-24s %10lld %10lld %10.1f%% %7.3f %7.3f\n", total.name.c_str(), total.vertices, total.triangles,
+		total.vertices > 0 ? 100.0 * total.duplicates / total.vertices : 0.0,
+		total.triangles > 0 ? misses / total.triangles : 0.0, total.vertices > 0 ? misses / total.vertices : 0.0);
+}
+
+static void printSectionSizes(const SectionSizes &sizes, bool estimated)
+{
+	long long total = 0;
+	for (std::map<std::string, long long>::const_iterator it = sizes.bytes.begin(); it != sizes.bytes.end(); it++)
+		total += it->second;
+	printf("\n%-24s %12s %7s\n", estimated ? "estimated output" : "output", "bytes", "");
+	for (std::map<std::string, long long>::const_iterator it = sizes.bytes.begin(); it != sizes.bytes.end(); it++)
+		printf("%-24s %12lld %6.1f%%\n", it->first.c_str(), it->second, total > 0 ? 100.0 * it->second / total : 0.0);
+	printf("%-24s %12lld\n", "total", total);
+}
+
+
+//stats of a model that is converted without assimp, from the converted data
+static bool convertedStats(const blib::json::Value &data)
+{
+	if (data.isNull())
+		return false;
+
+	int vertexSize = 0;
+	for (size_t i = 1; i < data["format"].size(); i += 2)
+		vertexSize += data["format"][i].asInt();
+	if (vertexSize == 0)
+		return false;
+	std::vector<float> vertices;
+	for (size_t i = 0; i < data["vertices"].size(); i++)
+		vertices.push_back(data["vertices"][i].asFloat());
+
+	std::vector<MeshStats> meshes;
+	for (size_t i = 0; i < data["meshes"].size(); i++)
+	{
+		std::vector<unsigned int> indices;
+		for (size_t ii = 0; ii < data["meshes"][i]["faces"].size(); ii++)
+			indices.push_back(data["meshes"][i]["faces"][ii].asInt());
+		meshes.push_back(meshStats(std::to_string(i), vertices, vertexSize, indices));
+	}
+	printMeshStats(meshes);
+
+	//the output is already there, so its sections are measured instead of estimated
+	SectionSizes sizes;
+	const char* sections[] = { "vertices", "meshes" };
+	for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); i++)
+	{
+		std::ostringstream out;
+		out << data[sections[i]];
+		sizes.add(sections[i], out.str().size());
+	}
+	printSectionSizes(sizes, false);
+	return true;
+}
+
+
+static bool sceneStats(const std::string &filename, const Options &options)
+{
+	SceneImport sceneImport(filename, options);
+	const aiScene* scene = sceneImport.scene;
+	if (!scene)
+	{
+		LOG(Error) << "Could not import " << filename << ": " << sceneImport.error;
+		return false;
+	}
+
+	//the vertices as the converter writes them: position, texcoord, normal, bone ids and weights
+	const int vertexSize = 8 + 2 * maxInfluences;
+	std::vector<MeshStats> meshes;
+	std::vector<long long> influences(maxInfluences + 2, 0);	// vertices per number of bones, the last is more than the output keeps
+	SectionSizes sizes;
+	long long vertexStart = 0;
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+	{
+		const aiMesh* mesh = scene->mMeshes[i];
+		std::vector<float> vertices(mesh->mNumVertices * vertexSize, 0.0f);
+		for (unsigned int ii = 0; ii < mesh->mNumVertices; ii++)
+		{
+			float* v = &vertices[ii * vertexSize];
+			v[0] = mesh->mVertices[ii].x;
+			v[1] = mesh->mVertices[ii].y;
+			v[2] = mesh->mVertices[ii].z;
+			if (mesh->HasTextureCoords(0))
+			{
+				v[3] = mesh->mTextureCoords[0][ii].x;
+				v[4] = mesh->mTextureCoords[0][ii].y;
+			}
+			if (mesh->HasNormals())
+			{
+				v[5] = mesh->mNormals[ii].x;
+				v[6] = mesh->mNormals[ii].y;
+				v[7] = mesh->mNormals[ii].z;
+			}
+			for (int iii = 0; iii < maxInfluences; iii++)
+				v[8 + iii] = -1;
+		}
+
+		std::vector<int> boneCounts(mesh->mNumVertices, 0);
+		for (unsigned int ii = 0; ii < mesh->mNumBones; ii++)
+		{
+			const aiBone* bone = mesh->mBones[ii];
+			for (unsigned int iii = 0; iii < bone->mNumWeights; iii++)
+			{
+				const aiVertexWeight &w = bone->mWeights[iii];
+				if (w.mVertexId >= mesh->mNumVertices)
+					continue;
+				int slot = boneCounts[w.mVertexId]++;
+				if (slot < maxInfluences)
+				{
+					vertices[w.mVertexId * vertexSize + 8 + slot] = (float)ii;
+					vertices[w.mVertexId * vertexSize + 8 + maxInfluences + slot] = w.mWeight;
+				}
+			}
+		}
+		if (mesh->mNumBones > 0)
+			for (unsigned int ii = 0; ii < mesh->mNumVertices; ii++)
+				influences[std::min(boneCounts[ii], maxInfluences + 1)]++;
+
+		std::vector<unsigned int> indices;
+		for (unsigned int ii = 0; ii < mesh->mNumFaces; ii++)
+			if (mesh->mFaces[ii].mNumIndices == 3)
+				indices.insert(indices.end(), mesh->mFaces[ii].mIndices, mesh->mFaces[ii].mIndices + 3);
+
+		std::string name = mesh->mName.length > 0 ? mesh->mName.C_Str() : std::to_string(i);
+		meshes.push_back(meshStats(name, vertices, vertexSize, indices));
+
+		for (size_t ii = 0; ii < vertices.size(); ii++)
+			sizes.add("vertices", numberBytes(vertices[ii]));
+		for (size_t ii = 0; ii < indices.size(); ii++)
+			sizes.add("faces", numberBytes((float)(vertexStart + indices[ii])));
+		sizes.add("materials", 200);
+		vertexStart += mesh->mNumVertices;
+	}
+	printMeshStats(meshes);
+
+	long long skinned = 0;
+	for (size_t i = 0; i < influences.size(); i++)
+		skinned += influences[i];
+	if (skinned > 0)
+	{
+		printf("\n%-24s %10s %7s\n", "bone influences", "vertices", "");
+		for (size_t i = 0; i < influences.size(); i++)
+			printf("%-24s %10lld %6.1f%%\n", i <= maxInfluences ? std::to_string(i).c_str() : (std::to_string(i) + "+ (dropped)").c_str(),
+				influences[i], 100.0 * influences[i] / skinned);
+		//a matrix and an offset matrix per bone, in the skeleton or in the meshes
+		long long bones = 0;
+		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+			bones += scene->mMeshes[i]->mNumBones;
+		sizes.add("skeleton", bones * 2 * 16 * 12);
+	}
+
+	for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+	{
+		const aiAnimation* animation = scene->mAnimations[i];
+		double tps = animation->mTicksPerSecond != 0 ? animation->mTicksPerSecond : 25;
+		printf("\nanimation %s, %.2f s\n", animation->mName.C_Str(), animation->mDuration / tps);
+		printf("%-32s %10s %10s %10s\n", "channel", "positions", "rotations", "scales");
+		long long keys[3] = { 0, 0, 0 };
+		for (unsigned int ii = 0; ii < animation->mNumChannels; ii++)
+		{
+			const aiNodeAnim* channel = animation->mChannels[ii];
+			printf("%-32s %10u %10u %10u\n", channel->mNodeName.C_Str(), channel->mNumPositionKeys, channel->mNumRotationKeys, channel->mNumScalingKeys);
+			keys[0] += channel->mNumPositionKeys;
+			keys[1] += channel->mNumRotationKeys;
+			keys[2] += channel->mNumScalingKeys;
+		}
+		printf("%-32s %10lld %10lld %10lld\n", "total", keys[0], keys[1], keys[2]);
+
+		//resampled tracks have every channel on every frame, binary keys are plain floats, json keys are about
+		//{ "pos" : [ x, y, z ], "time" : t } with the numbers printed at 8 or so characters
+		long long positions = keys[0], rotations = keys[1], scales = keys[2];
+		if (options.resampleRate > 0)
+			positions = rotations = scales = ((long long)(animation->mDuration / tps * options.resampleRate) + 1) * animation->mNumChannels;
+		long long numbers = positions * 4 + rotations * 5 + scales * 4;
+		if (options.binaryAnimations)
+			sizes.add("animations", numbers * 4);
+		else
+			sizes.add("animations", numbers * 9 + (options.resampleRate > 0 ? 0 : (positions + rotations + scales) * 24));
+	}
+	printSectionSizes(sizes, true);
+	return true;
+}
+
+
+bool printModelStats(const std::string &filename, const Options &options)
+{
+	std::string extension = fileExtension(filename);
+
+	printf("%s\n", filename.c_str());
+	bool ok = false;
+	if (extension == ".pmd")
+	{
+		blib::json::Value skeleton;
+		ok = convertedStats(convertPmd(filename, skeleton));
+	}
+	else if (extension == ".pmx")
+		ok = convertedStats(convertPmx(filename));
+	else if (extension == ".dae" || extension == ".obj" || extension == ".3ds" || extension == ".fbx")
+		ok = sceneStats(filename, options);
+	else
+		LOG(Error) << "No converter for " << filename;
+	printf("\n");
+	return ok;
+}
@@ -0,0 +1,104 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	queued = 0;
+	unfinished = 0;
+	nextQueue = 0;
+	stopping = false;
+	if (threadCount <= 0)
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	for (int i = 0; i < threadCount; i++)
+		queues.push_back(new Queue());
+	for (int i = 0; i < threadCount; i++)
+		threads.push_back(std::thread(&ThreadPool::run, this, (size_t)i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAdded.notify_all();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	for (size_t i = 0; i < queues.size(); i++)
+		delete queues[i];
+}
+
+void ThreadPool::addJob(const std::function<void()> &job)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		size_t index = nextQueue++ % queues.size();
+		for (size_t i = 0; i < threads.size(); i++)
+			if (threads[i].get_id() == std::this_thread::get_id())
+				index = i;
+		std::unique_lock<std::mutex> queueLock(queues[index]->mutex);
+		queues[index]->jobs.push_back(job);
+		queued++;
+		unfinished++;
+	}
+	jobAdded.notify_one();
+}
+
+void ThreadPool::waitForJobs()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (unfinished > 0)
+		jobFinished.wait(lock);
+}
+
+bool ThreadPool::takeJob(size_t index, std::function<void()> &job)
+{
+	for (size_t i = 0; i < queues.size(); i++)
+	{
+		Queue* queue = queues[(index + i) % queues.size()];
+		std::unique_lock<std::mutex> queueLock(queue->mutex);
+		if (queue->jobs.empty())
+			continue;
+		if (i == 0)
+		{
+			job = queue->jobs.back();
+			queue->jobs.pop_back();
+		}
+		else
+		{
+			job = queue->jobs.front();
+			queue->jobs.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::run(size_t index)
+{
+	while (true)
+	{
+		std::function<void()> job;
+		if (!takeJob(index, job))
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (queued == 0 && !stopping)
+				jobAdded.wait(lock);
+			if (queued == 0)
+				return; //only stop when all jobs are done
+			continue;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queued--;
+		}
+		job();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			unfinished--;
+		}
+		jobFinished.notify_all();
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Every thread has its own job queue. Jobs added from outside the pool are spread over the queues, jobs added by a job
+// go to the queue of the thread running it. A thread runs the newest job of its own queue first, and when that is empty
+// takes the oldest job from another thread's queue, so uneven jobs keep all threads busy
+class ThreadPool
+{
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()> > jobs;
+	};
+
+	std::vector<std::thread> threads;
+	std::vector<Queue*> queues;
+	std::mutex mutex;
+	std::condition_variable jobAdded;
+	std::condition_variable jobFinished;
+	int queued;		// jobs waiting in a queue
+	int unfinished;	// jobs waiting or running
+	unsigned int nextQueue;
+	bool stopping;
+
+	bool takeJob(size_t index, std::function<void()> &job);
+	void run(size_t index);
+public:
+	ThreadPool(int threadCount = 0); // 0 uses one thread per core
+	~ThreadPool();
+
+	void addJob(const std::function<void()> &job);
+	void waitForJobs();
+};
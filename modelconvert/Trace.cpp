@@ -0,0 +1,91 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "Trace.h"
+
+Trace trace;
+static thread_local int traceThread = -1;	// the lane of the thread
+
+
+Trace::Trace() : taken(0), on(false), threads(0)
+{
+}
+
+void Trace::open(const std::string &filename)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!filename.empty())
+	{
+		if (this->filename.empty())
+			atexit([]() { trace.save(); });
+		this->filename = filename;
+	}
+	if (traceThread == -1)
+		traceThread = threads++; // the main thread opens the trace, so it gets the first lane
+	if (!on)
+		start = std::chrono::steady_clock::now();
+	on = true;
+}
+
+void Trace::add(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+	if (traceThread == -1)
+		traceThread = threads++;
+	Event event;
+	event.name = name;
+	event.thread = traceThread;
+	event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - start).count();
+	event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+	std::lock_guard<std::mutex> lock(mutex);
+	events.push_back(event);
+}
+
+//written by hand instead of with blib::json, a trace easily has a few hundred thousand events
+void Trace::save()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!on || filename.empty())
+		return;
+	on = false;
+	std::ofstream out(filename.c_str());
+	if (!out.is_open())
+	{
+		printf("Could not write trace %s\n", filename.c_str());
+		return;
+	}
+	int pid = (int)getpid();
+	out << "{\"traceEvents\":[\n";
+	for (int i = 0; i < threads; i++)
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << i << ",\"args\":{\"name\":\"" << (i == 0 ? "main" : "thread " + std::to_string(i)) << "\"}},\n";
+	char buf[256];
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		snprintf(buf, sizeof(buf), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%i,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}%s\n", events[i].name, pid, events[i].thread,
+			events[i].start / 1000.0, events[i].duration / 1000.0, i + 1 < events.size() ? "," : "");
+		out << buf;
+	}
+	out << "]}\n";
+	printf("Wrote trace %s with %i events\n", filename.c_str(), (int)events.size());
+}
+
+std::map<std::string, double> Trace::takeStageTimes()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, double> times;
+	for (size_t i = taken; i < events.size(); i++)
+		times[events[i].name] += events[i].duration / 1e9;
+	if (filename.empty())
+		events.clear();
+	taken = events.size();
+	return times;
+}
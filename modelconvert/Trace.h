@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "MemoryStats.h"
+
+// Records how long the stages of a conversion take, and writes them as a chrome trace (open it in chrome://tracing or
+// ui.perfetto.dev) when the converter exits. Every thread gets a lane of its own. Stages are timed with TRACE_SCOPE,
+// which does not even read the clock when tracing is off. The scopes are also the stages that allocations are counted for
+class Trace
+{
+	struct Event
+	{
+		const char* name;
+		int thread;
+		long long start;	// in nanoseconds since the trace was opened
+		long long duration;
+	};
+	std::mutex mutex;
+	std::vector<Event> events;
+	size_t taken;		// events before this were already counted by takeStageTimes
+	std::string filename;
+	std::chrono::steady_clock::time_point start;
+	std::atomic<bool> on;
+	std::atomic<int> threads;
+public:
+	Trace();
+
+	// an empty filename only records, for stageTimes
+	void open(const std::string &filename);
+	bool enabled() const { return on; }
+	// name has to stay valid until the trace is saved, usually it is a string literal
+	void add(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+	void save();
+	// total time in seconds per stage over all threads since the last call. Events are dropped afterwards when the trace
+	// is not written, so the benchmark does not keep every run
+	std::map<std::string, double> takeStageTimes();
+};
+
+extern Trace trace;
+
+class TraceScope
+{
+	const char* name;
+	int previousStage;
+	std::chrono::steady_clock::time_point begin;
+public:
+	TraceScope(const char* name) : name(trace.enabled() || memoryStatsEnabled ? name : NULL), previousStage(-1)
+	{
+		if (!this->name)
+			return;
+		if (memoryStatsEnabled)
+			previousStage = enterMemoryStage(name);
+		begin = std::chrono::steady_clock::now();
+	}
+	~TraceScope()
+	{
+		if (!name)
+			return;
+		if (trace.enabled())
+			trace.add(name, begin, std::chrono::steady_clock::now());
+		if (previousStage != -1)
+			leaveMemoryStage(previousStage);
+	}
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
@@ -0,0 +1,341 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#endif
+
+#include "ModelConvert.h"
+#include "Cache.h"
+
+// Watch mode converts the models in the watched directories that are older than their output, then waits for changes.
+// A save of a model, or of a file it depends on (mtl files and textures), marks the model as changed. When nothing was
+// saved for a short while, the changed models are converted in forked workers, and the time from the save to the new
+// output is reported. Textures do not change the output, but rewriting it lets a running game reload the model
+
+static const int debounceTime = 300;	// milliseconds, editors often write a file more than once when saving
+
+static bool isModel(const std::string &filename)
+{
+	size_t dot = filename.rfind(".");
+	if (dot == std::string::npos)
+		return false;
+	std::string extension = filename.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".pmd" || extension == ".pmx" || extension == ".dae" || extension == ".obj" || extension == ".3ds" || extension == ".fbx";
+}
+
+#ifndef __linux__
+
+int watchDirectories(const std::vector<std::string> &command, const std::vector<std::string> &directories, const Options &options)
+{
+	printf("Watching directories needs inotify, which is only available on Linux\n");
+	return -1;
+}
+
+#else
+
+struct WatchState
+{
+	int fd;
+	std::map<int, std::string> watches;		// watch descriptor to directory
+	std::set<std::string> watchedDirectories;
+	std::set<std::string> sourceDirectories;	// the directories new models are picked up from
+	std::map<std::string, std::vector<std::string> > dependencies;	// model to the files it is converted from, including itself
+	std::map<std::string, std::set<std::string> > dependents;		// file to the models converted from it
+	std::map<std::string, std::chrono::system_clock::time_point> changed;	// models to convert, with the time of the first save
+	std::chrono::steady_clock::time_point lastChange;
+};
+
+static std::string canonicalPath(const std::string &path)
+{
+	char buf[PATH_MAX];
+	if (realpath(path.c_str(), buf))
+		return buf;
+	return path;
+}
+
+static std::string directoryOf(const std::string &path)
+{
+	size_t slash = path.rfind('/');
+	if (slash == std::string::npos)
+		return ".";
+	return path.substr(0, slash);
+}
+
+static bool modifiedTime(const std::string &filename, double &time)
+{
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return false;
+	time = info.st_mtim.tv_sec + info.st_mtim.tv_nsec / 1e9;
+	return true;
+}
+
+//the newest output of a model, animated models have no model.json
+static double outputTime(const std::string &model)
+{
+	double json = 0;
+	double mesh = 0;
+	modifiedTime(model + ".json", json);
+	modifiedTime(model + ".mesh.json", mesh);
+	return std::max(json, mesh);
+}
+
+static void mtlTextures(const std::string &mtl, std::vector<std::string> &files)
+{
+	std::ifstream file(mtl.c_str());
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream tokens(line);
+		std::string keyword;
+		tokens >> keyword;
+		if (keyword.compare(0, 4, "map_") != 0 && keyword != "bump" && keyword != "disp" && keyword != "decal" && keyword != "refl")
+			continue;
+		std::string token;
+		std::string name;
+		while (tokens >> token)
+			name = token; // options like -bm 0.5 come before the filename
+		if (!name.empty())
+			files.push_back(directoryOf(mtl) + "/" + name);
+	}
+}
+
+static void colladaTextures(const std::string &dae, std::vector<std::string> &files)
+{
+	std::ifstream file(dae.c_str());
+	std::stringstream data;
+	data << file.rdbuf();
+	std::string text = data.str();
+	for (size_t pos = text.find("<init_from>"); pos != std::string::npos; pos = text.find("<init_from>", pos))
+	{
+		pos += 11;
+		size_t end = text.find("</init_from>", pos);
+		if (end == std::string::npos)
+			break;
+		std::string name = text.substr(pos, end - pos);
+		if (name.compare(0, 7, "file://") == 0)
+			name = name.substr(7);
+		if (name.empty() || name[0] == '#' || name.find('<') != std::string::npos)
+			continue;
+		files.push_back(name[0] == '/' ? name : directoryOf(dae) + "/" + name);
+	}
+}
+
+static std::vector<std::string> dependencyFiles(const std::string &model)
+{
+	std::vector<std::string> files(1, model);
+	std::vector<std::string> side = sideFiles(model);
+	for (size_t i = 0; i < side.size(); i++)
+	{
+		files.push_back(side[i]);
+		mtlTextures(side[i], files);
+	}
+	if (model.size() > 4 && model.compare(model.size() - 4, 4, ".dae") == 0)
+		colladaTextures(model, files);
+	for (size_t i = 0; i < files.size(); i++) // the directory, as a missing texture can still be saved later
+		files[i] = canonicalPath(directoryOf(files[i])) + files[i].substr(files[i].rfind('/'));
+	return files;
+}
+
+static void watchDirectory(WatchState &state, const std::string &directory)
+{
+	if (state.watchedDirectories.count(directory))
+		return;
+	int wd = inotify_add_watch(state.fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd < 0)
+	{
+		printf("Could not watch %s: %s\n", directory.c_str(), strerror(errno));
+		return;
+	}
+	state.watches[wd] = directory;
+	state.watchedDirectories.insert(directory);
+}
+
+//(re)reads what the model depends on, a changed mtl file can use other textures
+static void trackModel(WatchState &state, const std::string &model)
+{
+	std::vector<std::string> &files = state.dependencies[model];
+	for (size_t i = 0; i < files.size(); i++)
+		state.dependents[files[i]].erase(model);
+	files = dependencyFiles(model);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		state.dependents[files[i]].insert(model);
+		watchDirectory(state, directoryOf(files[i]));
+	}
+}
+
+//watches the directory and everything below it, and returns the models in it
+static void scanDirectory(WatchState &state, const std::string &directory, std::vector<std::string> &models)
+{
+	watchDirectory(state, directory);
+	state.sourceDirectories.insert(directory);
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+		return;
+	while (struct dirent* entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (name == "." || name == "..")
+			continue;
+		std::string path = directory + "/" + name;
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			continue;
+		if (S_ISDIR(info.st_mode))
+			scanDirectory(state, path, models);
+		else if (isModel(path))
+			models.push_back(path);
+	}
+	closedir(dir);
+}
+
+static void readEvents(WatchState &state)
+{
+	alignas(struct inotify_event) char buf[65536];
+	ssize_t len = read(state.fd, buf, sizeof(buf));
+	std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+	for (char* p = buf; len > 0 && p < buf + len; )
+	{
+		const struct inotify_event* event = (const struct inotify_event*)p;
+		p += sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_IGNORED)
+		{
+			state.watchedDirectories.erase(state.watches[event->wd]);
+			state.watches.erase(event->wd);
+			continue;
+		}
+		std::map<int, std::string>::iterator directory = state.watches.find(event->wd);
+		if (event->len == 0 || directory == state.watches.end())
+			continue;
+		std::string path = directory->second + "/" + event->name;
+
+		if (event->mask & IN_ISDIR)
+		{
+			if (!state.sourceDirectories.count(directory->second))
+				continue;
+			std::vector<std::string> models;
+			scanDirectory(state, path, models);
+			for (size_t i = 0; i < models.size(); i++)
+				state.changed.insert(std::make_pair(models[i], now));
+			state.lastChange = std::chrono::steady_clock::now();
+			continue;
+		}
+		if (!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)))
+			continue;
+
+		if (isModel(path) && !state.dependencies.count(path) && state.sourceDirectories.count(directory->second))
+			state.changed.insert(std::make_pair(path, now));
+		std::map<std::string, std::set<std::string> >::iterator models = state.dependents.find(path);
+		if (models != state.dependents.end())
+			for (std::set<std::string>::iterator it = models->second.begin(); it != models->second.end(); it++)
+				state.changed.insert(std::make_pair(*it, now));
+		state.lastChange = std::chrono::steady_clock::now();
+	}
+}
+
+static void convertChanged(WatchState &state, const std::vector<std::string> &command, const Options &options)
+{
+	std::map<std::string, std::chrono::system_clock::time_point> changed;
+	changed.swap(state.changed);
+	std::vector<std::string> models;
+	for (std::map<std::string, std::chrono::system_clock::time_point>::iterator it = changed.begin(); it != changed.end(); it++)
+	{
+		double time;
+		if (modifiedTime(it->first, time))
+			models.push_back(it->first);
+	}
+	if (models.empty())
+		return;
+	isolatedBatch(command, models, options);
+
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		trackModel(state, models[i]);
+		double saved = std::chrono::duration<double>(changed[models[i]].time_since_epoch()).count();
+		double written = outputTime(models[i]);
+		if (written >= saved)
+			printf("%s was updated %.2fs after it was saved\n", models[i].c_str(), written - saved);
+	}
+	fflush(stdout);
+}
+
+
+int watchDirectories(const std::vector<std::string> &command, const std::vector<std::string> &directories, const Options &options)
+{
+	WatchState state;
+	state.fd = inotify_init1(IN_CLOEXEC);
+	if (state.fd < 0)
+	{
+		printf("Could not start watching: %s\n", strerror(errno));
+		return -1;
+	}
+
+	std::vector<std::string> models;
+	for (size_t i = 0; i < directories.size(); i++)
+		scanDirectory(state, canonicalPath(directories[i]), models);
+
+	//convert what changed while nobody was watching
+	std::vector<std::string> outdated;
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		trackModel(state, models[i]);
+		double output = outputTime(models[i]);
+		const std::vector<std::string> &files = state.dependencies[models[i]];
+		for (size_t ii = 0; ii < files.size(); ii++)
+		{
+			double time;
+			if (modifiedTime(files[ii], time) && time > output)
+			{
+				outdated.push_back(models[i]);
+				break;
+			}
+		}
+	}
+	printf("Watching %i models in %i directories, %i need converting\n", (int)models.size(), (int)state.watchedDirectories.size(), (int)outdated.size());
+	if (!outdated.empty())
+		isolatedBatch(command, outdated, options);
+	fflush(stdout);
+
+	while (true)
+	{
+		int timeout = -1;
+		if (!state.changed.empty())
+		{
+			int quiet = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - state.lastChange).count();
+			timeout = std::max(0, debounceTime - quiet);
+		}
+		struct pollfd fd;
+		fd.fd = state.fd;
+		fd.events = POLLIN;
+		fd.revents = 0;
+		int ready = poll(&fd, 1, timeout);
+		if (ready < 0 && errno != EINTR)
+			break;
+		if (ready > 0)
+			readEvents(state);
+		else if (ready == 0)
+			convertChanged(state, command, options);
+	}
+	close(state.fd);
+	return 0;
+}
+
+#endif
@@ -6,24 +6,26 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <blib/json.h>
-#include <blib/util/Log.h>
 #include <blib/util/FileSystem.h>
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
-blib::json::Value convertAssimpAnim(const std::string &filename);
+#include "ModelConvert.h"
+#include "SceneImport.h"
+#include "ThreadPool.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "Logger.h"
 
 
 #pragma comment(lib, "../externals/assimp/assimp.lib")
 
-using blib::util::Log;
 
 
 int vertexSize = 0;
 
-
 blib::json::Value matrixAsJson(const aiMatrix4x4& matrix)
 {
 	blib::json::Value ret;
@@ -41,7 +43,19 @@ blib::json::Value matrixAsJson(const aiMatrix4x4& matrix)
 }
 
 
-void import(blib::json::Value &data, const aiScene* scene, aiNode* node, glm::mat4 matrix)
+// one mesh as it is placed in the scene, with everything import produces for it
+struct MeshWork
+{
+	const aiMesh* mesh;
+	glm::mat4 matrix;
+	int vertexStart;
+	bool calculatedNormals;
+	std::vector<float> vertices;
+	blib::json::Value meshData;
+};
+
+//lists the meshes in the order the node tree is written, with the accumulated matrix of their node
+static void collectMeshes(const aiScene* scene, aiNode* node, glm::mat4 matrix, std::vector<MeshWork> &work)
 {
 
 	glm::mat4 transformation = glm::make_mat4((float*)&node->mTransformation);
@@ -53,184 +67,235 @@ void import(blib::json::Value &data, const aiScene* scene, aiNode* node, glm::ma
 
 	for (unsigned int i = 0; i < node->mNumMeshes; i++)
 	{
-		const struct aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		std::vector<glm::vec3> faceNormals;
-		std::vector<glm::vec3> vertexNormals;
-		if (!mesh->HasNormals())
-		{
-			Log::out << "Mesh does not have normals...calculating" << Log::newline;
+		MeshWork item;
+		item.mesh = scene->mMeshes[node->mMeshes[i]];
+		item.matrix = matrix;
+		item.vertexStart = 0;
+		item.calculatedNormals = false;
+		work.push_back(item);
+	}
 
-			for (unsigned int ii = 0; ii < mesh->mNumFaces; ii++)
-			{
-				const struct aiFace* face = &mesh->mFaces[ii];
-				if (face->mNumIndices > 2)
-				{
-					glm::vec3 v1(mesh->mVertices[face->mIndices[0]].x, mesh->mVertices[face->mIndices[0]].y, mesh->mVertices[face->mIndices[0]].z);
-					glm::vec3 v2(mesh->mVertices[face->mIndices[1]].x, mesh->mVertices[face->mIndices[1]].y, mesh->mVertices[face->mIndices[1]].z);
-					glm::vec3 v3(mesh->mVertices[face->mIndices[2]].x, mesh->mVertices[face->mIndices[2]].y, mesh->mVertices[face->mIndices[2]].z);
-					v1 = glm::vec3(glm::vec4(v1, 1) * matrix);
-					v2 = glm::vec3(glm::vec4(v2, 1) * matrix);
-					v3 = glm::vec3(glm::vec4(v3, 1) * matrix);
-
-					glm::vec3 normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
-					faceNormals.push_back(normal);
-				}
-				else
-					faceNormals.push_back(glm::vec3(0, 0, 0));
-			}
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+		collectMeshes(scene, node->mChildren[i], matrix, work);
+}
 
+//transforms the vertices, calculates missing normals and builds the material and face list of one mesh. Only touches work
+static void importMesh(const aiScene* scene, MeshWork &work)
+{
+	TRACE_SCOPE("import mesh");
+	const struct aiMesh* mesh = work.mesh;
+	const glm::mat4 &matrix = work.matrix;
+	std::vector<glm::vec3> faceNormals;
+	std::vector<glm::vec3> vertexNormals;
+	if (!mesh->HasNormals())
+	{
+		TRACE_SCOPE("calculate normals");
+		work.calculatedNormals = true;
 
-			for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+		for (unsigned int ii = 0; ii < mesh->mNumFaces; ii++)
+		{
+			const struct aiFace* face = &mesh->mFaces[ii];
+			if (face->mNumIndices > 2)
 			{
-				glm::vec3 normal(0, 0, 0);
-				for (unsigned int ii = 0; ii < mesh->mNumFaces; ii++)
-				{
-					const struct aiFace* face = &mesh->mFaces[ii];
-					for (unsigned int iii = 0; iii < face->mNumIndices; iii++)
-					{
-						if (face->mIndices[iii] == i)
-							normal += faceNormals[ii];
-					}
-				}
-				if (glm::length(normal) > 0.1)
-					normal = glm::normalize(normal);
-				vertexNormals.push_back(normal);
+				glm::vec3 v1(mesh->mVertices[face->mIndices[0]].x, mesh->mVertices[face->mIndices[0]].y, mesh->mVertices[face->mIndices[0]].z);
+				glm::vec3 v2(mesh->mVertices[face->mIndices[1]].x, mesh->mVertices[face->mIndices[1]].y, mesh->mVertices[face->mIndices[1]].z);
+				glm::vec3 v3(mesh->mVertices[face->mIndices[2]].x, mesh->mVertices[face->mIndices[2]].y, mesh->mVertices[face->mIndices[2]].z);
+				v1 = glm::vec3(glm::vec4(v1, 1) * matrix);
+				v2 = glm::vec3(glm::vec4(v2, 1) * matrix);
+				v3 = glm::vec3(glm::vec4(v3, 1) * matrix);
+
+				glm::vec3 normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
+				faceNormals.push_back(normal);
 			}
+			else
+				faceNormals.push_back(glm::vec3(0, 0, 0));
 		}
 
 
-		int vertexStart = data["vertices"].size() / 8;
-		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+		//sums the face normals in face order for every vertex, in one pass over the faces
+		vertexNormals.resize(mesh->mNumVertices, glm::vec3(0, 0, 0));
+		for (unsigned int ii = 0; ii < mesh->mNumFaces; ii++)
 		{
-			glm::vec4 vertex(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z, 1.0f);
-			vertex = vertex * matrix;
-
-			data["vertices"].push_back(vertex.x);
-			data["vertices"].push_back(vertex.y);
-			data["vertices"].push_back(vertex.z);
-
-			if (mesh->HasTextureCoords(0))
-			{
-				data["vertices"].push_back(mesh->mTextureCoords[0][i].x);
-				data["vertices"].push_back(1 - mesh->mTextureCoords[0][i].y);
-			}
-			else
-			{
-				data["vertices"].push_back(0);
-				data["vertices"].push_back(0);
-			}
-			glm::vec4 normal;
-			if (mesh->HasNormals())
-			{
-				normal = glm::vec4(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z, 0.0f);
-				normal = normal * matrix; // TODO: should this be matrix, or should this be a normalmatrix?
-			}
-			else
-			{
-				normal = glm::vec4(vertexNormals[i], 0) * matrix; // TODO: matrix
-			}
-
-			data["vertices"].push_back(normal.x);
-			data["vertices"].push_back(normal.y);
-			data["vertices"].push_back(normal.z);
-			
-	/*		//boneIDs
-			data["vertices"].push_back(-1);
-			data["vertices"].push_back(-1);
-			data["vertices"].push_back(-1);
-			data["vertices"].push_back(-1);
-
-			//weights
-			data["vertices"].push_back(0.0f);
-			data["vertices"].push_back(0.0f);
-			data["vertices"].push_back(0.0f);
-			data["vertices"].push_back(0.0f);*/
+			const struct aiFace* face = &mesh->mFaces[ii];
+			for (unsigned int iii = 0; iii < face->mNumIndices; iii++)
+				vertexNormals[face->mIndices[iii]] += faceNormals[ii];
 		}
+		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+			if (glm::length(vertexNormals[i]) > 0.1)
+				vertexNormals[i] = glm::normalize(vertexNormals[i]);
+	}
 
 
-		const aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-
-		aiColor4D diffuse;
-		aiColor4D specular;
-		aiColor4D ambient;
-		aiColor4D transparency;
-		aiString texPath;
+	work.vertices.reserve(mesh->mNumVertices * 8);
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	{
+		glm::vec4 vertex(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z, 1.0f);
+		vertex = vertex * matrix;
 
-		blib::json::Value meshData;
+		work.vertices.push_back(vertex.x);
+		work.vertices.push_back(vertex.y);
+		work.vertices.push_back(vertex.z);
 
-		if (aiGetMaterialColor(material, AI_MATKEY_COLOR_DIFFUSE, &diffuse) == aiReturn_SUCCESS)
+		if (mesh->HasTextureCoords(0))
 		{
-			meshData["material"]["diffuse"].push_back(diffuse.r);
-			meshData["material"]["diffuse"].push_back(diffuse.g);
-			meshData["material"]["diffuse"].push_back(diffuse.b);
+			work.vertices.push_back(mesh->mTextureCoords[0][i].x);
+			work.vertices.push_back(1 - mesh->mTextureCoords[0][i].y);
 		}
 		else
 		{
-			meshData["material"]["diffuse"].push_back(0.5f);
-			meshData["material"]["diffuse"].push_back(0.5f);
-			meshData["material"]["diffuse"].push_back(0.5f);
+			work.vertices.push_back(0);
+			work.vertices.push_back(0);
 		}
-
-
-		if (aiGetMaterialColor(material, AI_MATKEY_COLOR_AMBIENT, &specular) == aiReturn_SUCCESS)
+		glm::vec4 normal;
+		if (mesh->HasNormals())
 		{
-			meshData["material"]["ambient"].push_back(ambient.r);
-			meshData["material"]["ambient"].push_back(ambient.g);
-			meshData["material"]["ambient"].push_back(ambient.b);
+			normal = glm::vec4(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z, 0.0f);
+			normal = normal * matrix; // TODO: should this be matrix, or should this be a normalmatrix?
 		}
 		else
 		{
-			meshData["material"]["ambient"].push_back(0.5f);
-			meshData["material"]["ambient"].push_back(0.5f);
-			meshData["material"]["ambient"].push_back(0.5f);
+			normal = glm::vec4(vertexNormals[i], 0) * matrix; // TODO: matrix
 		}
 
-		if (aiGetMaterialColor(material, AI_MATKEY_COLOR_SPECULAR, &specular) == aiReturn_SUCCESS)
-		{
-			meshData["material"]["specular"].push_back(specular.r);
-			meshData["material"]["specular"].push_back(specular.g);
-			meshData["material"]["specular"].push_back(specular.b);
-		}
-		else
-		{
-			meshData["material"]["specular"].push_back(1.0f);
-			meshData["material"]["specular"].push_back(1.0f);
-			meshData["material"]["specular"].push_back(1.0f);
-		}
+		work.vertices.push_back(normal.x);
+		work.vertices.push_back(normal.y);
+		work.vertices.push_back(normal.z);
+		
+/*		//boneIDs
+		data["vertices"].push_back(-1);
+		data["vertices"].push_back(-1);
+		data["vertices"].push_back(-1);
+		data["vertices"].push_back(-1);
+
+		//weights
+		data["vertices"].push_back(0.0f);
+		data["vertices"].push_back(0.0f);
+		data["vertices"].push_back(0.0f);
+		data["vertices"].push_back(0.0f);*/
+	}
 
-		if (aiGetMaterialColor(material, AI_MATKEY_COLOR_TRANSPARENT, &transparency) == aiReturn_SUCCESS)
-			meshData["material"]["alpha"] = transparency.a;
-		else
-			meshData["material"]["alpha"] = 1;
 
-		if (aiGetMaterialColor(material, AI_MATKEY_SHININESS, &transparency) == aiReturn_SUCCESS)
-			meshData["material"]["shinyness"] = transparency.a;
-		else
-			meshData["material"]["shinyness"] = 0;
+	const aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 
+	aiColor4D diffuse;
+	aiColor4D specular;
+	aiColor4D ambient;
+	aiColor4D transparency;
+	aiString texPath;
 
-		
+	blib::json::Value &meshData = work.meshData;
 
-		if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texPath) == aiReturn_SUCCESS)
-			meshData["material"]["texture"] = texPath.C_Str();
-		else
-			meshData["material"]["texture"] = "../textures/whitepixel.png";
+	if (aiGetMaterialColor(material, AI_MATKEY_COLOR_DIFFUSE, &diffuse) == aiReturn_SUCCESS)
+	{
+		meshData["material"]["diffuse"].push_back(diffuse.r);
+		meshData["material"]["diffuse"].push_back(diffuse.g);
+		meshData["material"]["diffuse"].push_back(diffuse.b);
+	}
+	else
+	{
+		meshData["material"]["diffuse"].push_back(0.5f);
+		meshData["material"]["diffuse"].push_back(0.5f);
+		meshData["material"]["diffuse"].push_back(0.5f);
+	}
 
-		for (unsigned int ii = 0; ii < mesh->mNumFaces; ii++)
-		{
-			const struct aiFace* face = &mesh->mFaces[ii];
-			if (face->mNumIndices != 3)
-				continue;
-			assert(face->mNumIndices == 3);
 
-			for (int iii = 0; iii < 3; iii++)
-				meshData["faces"].push_back(vertexStart + (int)face->mIndices[iii]);
-		}
+	if (aiGetMaterialColor(material, AI_MATKEY_COLOR_AMBIENT, &specular) == aiReturn_SUCCESS)
+	{
+		meshData["material"]["ambient"].push_back(ambient.r);
+		meshData["material"]["ambient"].push_back(ambient.g);
+		meshData["material"]["ambient"].push_back(ambient.b);
+	}
+	else
+	{
+		meshData["material"]["ambient"].push_back(0.5f);
+		meshData["material"]["ambient"].push_back(0.5f);
+		meshData["material"]["ambient"].push_back(0.5f);
+	}
 
+	if (aiGetMaterialColor(material, AI_MATKEY_COLOR_SPECULAR, &specular) == aiReturn_SUCCESS)
+	{
+		meshData["material"]["specular"].push_back(specular.r);
+		meshData["material"]["specular"].push_back(specular.g);
+		meshData["material"]["specular"].push_back(specular.b);
+	}
+	else
+	{
+		meshData["material"]["specular"].push_back(1.0f);
+		meshData["material"]["specular"].push_back(1.0f);
+		meshData["material"]["specular"].push_back(1.0f);
+	}
+
+	if (aiGetMaterialColor(material, AI_MATKEY_COLOR_TRANSPARENT, &transparency) == aiReturn_SUCCESS)
+		meshData["material"]["alpha"] = transparency.a;
+	else
+		meshData["material"]["alpha"] = 1;
+
+	if (aiGetMaterialColor(material, AI_MATKEY_SHININESS, &transparency) == aiReturn_SUCCESS)
+		meshData["material"]["shinyness"] = transparency.a;
+	else
+		meshData["material"]["shinyness"] = 0;
+
+
+	
+
+	if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texPath) == aiReturn_SUCCESS)
+		meshData["material"]["texture"] = texPath.C_Str();
+	else
+		meshData["material"]["texture"] = "../textures/whitepixel.png";
 
+	for (unsigned int ii = 0; ii < mesh->mNumFaces; ii++)
+	{
+		const struct aiFace* face = &mesh->mFaces[ii];
+		if (face->mNumIndices != 3)
+			continue;
+		assert(face->mNumIndices == 3);
+
+		for (int iii = 0; iii < 3; iii++)
+			meshData["faces"].push_back(work.vertexStart + (int)face->mIndices[iii]);
+	}
+}
+
+//imports all meshes of the scene into data. The meshes are converted in parallel, and then added in the order of the node tree
+void import(blib::json::Value &data, const aiScene* scene, aiNode* node, glm::mat4 matrix, int threads)
+{
+	TRACE_SCOPE("import");
+	std::vector<MeshWork> work;
+	collectMeshes(scene, node, matrix, work);
+
+	//every mesh gets its range in the vertex list up front, so its faces can be numbered before the meshes before it are done
+	int vertexStart = data["vertices"].size() / 8;
+	for (size_t i = 0; i < work.size(); i++)
+	{
+		work[i].vertexStart = vertexStart;
+		vertexStart += work[i].mesh->mNumVertices;
+	}
+
+	{
+		ThreadPool pool(threads);
+		for (size_t i = 0; i < work.size(); i++)
+		{
+			MeshWork* item = &work[i];
+			pool.addJob([scene, item]()
+			{
+				if (!progress.isCancelled())
+					importMesh(scene, *item);
+			});
+		}
+	}
+
+	for (size_t i = 0; i < work.size() && progress.update("meshes", i / (float)work.size()); i++)
+	{
+		TRACE_SCOPE("merge mesh");
+		const struct aiMesh* mesh = work[i].mesh;
+		blib::json::Value &meshData = work[i].meshData;
+		if (work[i].calculatedNormals)
+			LOG(Warning) << "Mesh does not have normals...calculating";
+		for (size_t ii = 0; ii < work[i].vertices.size(); ii++)
+			data["vertices"].push_back(work[i].vertices[ii]);
 
 		if (mesh->HasBones())
 		{
+			TRACE_SCOPE("bones");
 			std::function<void(aiNode* node, blib::json::Value& data)> writeNode;
 			writeNode = [&writeNode, &mesh, &data](aiNode* node, blib::json::Value& d)
 			{
@@ -278,44 +343,26 @@ void import(blib::json::Value &data, const aiScene* scene, aiNode* node, glm::ma
 		if (meshData.isMember("faces"))
 			data["meshes"].push_back(meshData);
 	}
-
-
-	for (unsigned int i = 0; i < node->mNumChildren; i++)
-	{
-		import(data, scene, node->mChildren[i], matrix);
-	}
-
-
-
 }
 
 
 
-blib::json::Value convertAssimp(std::string filename)
+blib::json::Value convertAssimp(std::string filename, const Options &options, std::vector<std::string> &outputFiles)
 {
-	blib::util::FileSystem::registerHandler(new blib::util::PhysicalFileSystemHandler(""));
-	Assimp::Importer importer;
-	
-	char* data;
-	int len = blib::util::FileSystem::getData(filename, data);
-
-	if (len == 0)
-	{
-		printf("Error opening file %s\n", filename.c_str());
-		return blib::json::Value();
-	}
-
-	const aiScene* scene = importer.ReadFileFromMemory(data, len, aiProcessPreset_TargetRealtime_Quality | aiProcess_OptimizeMeshes | aiProcess_RemoveRedundantMaterials | aiProcess_OptimizeGraph, filename.substr(filename.rfind(".")).c_str());
+	static std::once_flag registered; // a daemon converts many models, the handler is only needed once
+	std::call_once(registered, []() { blib::util::FileSystem::registerHandler(new blib::util::PhysicalFileSystemHandler("")); });
+	SceneImport sceneImport(filename, options);
+	const aiScene* scene = sceneImport.scene;
 	if (!scene)
 	{
-		printf("Errors? : %s\n", importer.GetErrorString());
+		LOG(Error) << "Could not import " << filename << ": " << sceneImport.error;
 		return blib::json::Value();
 	}
 
 	if (scene->HasAnimations())
 	{
-		Log::out << "Found animation!" << Log::newline;
-		return convertAssimpAnim(filename);
+		LOG(Info) << "Found animation!";
+		return convertAssimpAnim(filename, options, outputFiles);
 	}
 
 
@@ -345,14 +392,16 @@ blib::json::Value convertAssimp(std::string filename)
 
 
 
-	import(jsonData, scene, scene->mRootNode, glm::rotate(glm::rotate(glm::mat4(), 180.0f, glm::vec3(1,0,0)), 180.0f, glm::vec3(0,0,1)));
+	import(jsonData, scene, scene->mRootNode, glm::rotate(glm::rotate(glm::mat4(), 180.0f, glm::vec3(1,0,0)), 180.0f, glm::vec3(0,0,1)), options.threads);
+	if (progress.isCancelled())
+		return blib::json::Value();
 
 	if (scene->HasAnimations())
 	{
 		for (unsigned int i = 0; i < scene->mNumAnimations; i++)
 		{
 			const aiAnimation* animation = scene->mAnimations[i];
-			Log::out << "Animation found: " << animation->mName.C_Str() << Log::newline;
+			LOG(Info) << "Animation found: " << animation->mName.C_Str();
 
 			blib::json::Value animData;
 			animData["name"] = animation->mName.C_Str();
@@ -367,7 +416,7 @@ blib::json::Value convertAssimp(std::string filename)
 			for (unsigned int ii = 0; ii < animation->mNumChannels; ii++)
 			{
 				const aiNodeAnim* anim = animation->mChannels[ii];
-				Log::out << "Found animation for node " << anim->mNodeName.C_Str() << Log::newline;
+				LOG(Debug) << "Found animation for node " << anim->mNodeName.C_Str();
 
 				blib::json::Value channel;
 				channel["name"] = anim->mNodeName.C_Str();
@@ -1,62 +1,84 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 #include <algorithm>
 #include <direct.h>
 #include <blib/Util.h>
 #include <blib/json.h>
 #include <blib/util/FileSystem.h>
-
-blib::json::Value convertPmd(std::string filename);
-blib::json::Value convertAssimp(std::string filename);
-blib::json::Value convertAssimpAnim(const std::string &filename);
+#include "ModelConvert.h"
+#include "Cache.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "Logger.h"
 
 #pragma comment(lib, "blib.lib")
 
 
-int main(int argc, char* argv[])
+std::string fileExtension(const std::string &filename)
 {
-	blib::util::FileSystem::registerHandler(new blib::util::PhysicalFileSystemHandler());
-	printf("ModelConverter...\n");
-	if (argc == 1)
-	{
-		printf("Please add a model filename as 2nd parameter\n");
-		getchar();
-		return -1;
-	}
-
-	char buf[1024];
-	_getcwd(buf, 1024);
-	printf("Current working dir: %s\n", buf);
-
-
-	std::string filename = argv[1];
-	std::replace(filename.begin(), filename.end(), '/', '\\');
-	std::string extension = filename.substr(filename.rfind("."));
+	size_t dot = filename.rfind('.');
+	size_t slash = filename.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return "";
+	std::string extension = filename.substr(dot);
 	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension;
+}
 
-	printf("Extension found: %s\n", extension.c_str());
-
+blib::json::Value convertModel(const std::string &filename, const Options &options, std::vector<std::string> &outputFiles)
+{
+	std::string extension = fileExtension(filename);
+	if (extension != ".pmd" && extension != ".pmx" && extension != ".dae" && extension != ".obj" && extension != ".3ds" && extension != ".fbx")
+	{
+		LOG(Error) << "No converter for " << filename;
+		return blib::json::Value();
+	}
 
+	TRACE_SCOPE("convert");
+	progress.begin(filename, options.deadline);
 	blib::json::Value data;
-
 	if (extension == ".pmd")
-		data = convertPmd(filename);
+	{
+		blib::json::Value skeleton;
+		data = convertPmd(filename, skeleton);
+		if (!data.isNull() && !skeleton.isNull())
+		{
+			outputFiles.push_back(filename + ".skel.json");
+			writeSkeleton(skeleton, filename + ".skel.json" + options.outputSuffix);
+		}
+	}
+	if (extension == ".pmx")
+		data = convertPmx(filename);
 	if (extension == ".dae")
-		data = convertAssimp(filename);
+		data = convertAssimp(filename, options, outputFiles);
 	if (extension == ".obj")
-		data = convertAssimp(filename);
+		data = convertAssimp(filename, options, outputFiles);
 	if (extension == ".3ds")
-		data = convertAssimp(filename);
+		data = convertAssimp(filename, options, outputFiles);
 	if (extension == ".fbx")
-		data = convertAssimp(filename);
-
+		data = convertAssimp(filename, options, outputFiles);
+	if (progress.isCancelled())
+	{
+		data = blib::json::Value();
+		removeOutputFiles(outputFiles, options);
+	}
+	progress.end(!data.isNull() || !outputFiles.empty());
+	return data;
+}
 
-	std::string outfile = filename + ".json";
-	if (argc > 2)
-		outfile = argv[2];
+void removeOutputFiles(std::vector<std::string> &outputFiles, const Options &options)
+{
+	for (size_t i = 0; i < outputFiles.size(); i++)
+		remove((outputFiles[i] + options.outputSuffix).c_str());
+	outputFiles.clear();
+}
 
+void writeModel(blib::json::Value &data, std::ostream &out)
+{
 	std::string format = R"V0G0N(	
 	{
 		"wrap" : 1,
@@ -97,23 +119,379 @@ int main(int argc, char* argv[])
 		{
 			"wrap" : 8,
 			"seperator" : "	"
+		},
+		"morphs" :
+		{
+			"wrap" : 1,
+			"elements" :
+			{
+				"vertices" :
+				{
+					"wrap" : 16
+				},
+				"offsets" :
+				{
+					"wrap" : 12
+				}
+			}
 		}
 	})V0G0N";
 	blib::json::Value wrapConfig = blib::json::readJson(format);
+	TRACE_SCOPE("pretty print");
+	data.prettyPrint(out, wrapConfig);
+}
+
+void writeModel(blib::json::Value &data, const std::string &outfile)
+{
+	//std::ofstream(outfile) << data;
+	TRACE_SCOPE("write model");
+	std::ofstream out(outfile);
+	writeModel(data, out);
+}
+
+
+//options that change a single conversion, these are also sent along with the requests to a daemon. Returns false
+//when args[i] is not one of them, and sets error when it is, but its value is wrong
+bool conversionOption(const std::vector<std::string> &args, size_t &i, Options &options, std::string &error)
+{
+	const std::string &arg = args[i];
+	bool hasValue = i + 1 < args.size();
+	if (arg == "--resample" && hasValue)
+		options.resampleRate = (float)atof(args[++i].c_str());
+	else if (arg == "--reduce" && hasValue)
+		options.reducePosition = options.reduceRotation = options.reduceScale = (float)atof(args[++i].c_str());
+	else if (arg == "--reduce-position" && hasValue)
+		options.reducePosition = (float)atof(args[++i].c_str());
+	else if (arg == "--reduce-rotation" && hasValue)
+		options.reduceRotation = (float)atof(args[++i].c_str());
+	else if (arg == "--reduce-scale" && hasValue)
+		options.reduceScale = (float)atof(args[++i].c_str());
+	else if (arg == "--binary-anim")
+		options.binaryAnimations = true;
+	else if (arg == "--threads" && hasValue)
+		options.threads = atoi(args[++i].c_str());
+	else if (arg == "--cache" && hasValue)
+		options.cacheDirectory = args[++i];
+	else if (arg == "--cache-size" && hasValue)
+		options.cacheSize = atoi(args[++i].c_str());
+	else if (arg == "--cache-link")
+		options.cacheLinks = true;
+	else if (arg == "--scene-cache" && hasValue)
+		options.sceneCacheDirectory = args[++i];
+	else if (arg == "--profile" && hasValue)
+	{
+		if (!importProfile(args[++i], options.importFlags))
+			error = "Unknown import profile " + args[i];
+	}
+	else if (arg == "--native-steps")
+		options.nativeSteps = true;
+	else if (arg == "--native-obj")
+		options.nativeObj = true;
+	else if (arg == "--deadline" && hasValue)
+		options.deadline = atoi(args[++i].c_str());
+	else
+		return false;
+	return true;
+}
+
+
+static int run(int argc, char* argv[])
+{
+	blib::util::FileSystem::registerHandler(new blib::util::PhysicalFileSystemHandler());
+	LOG(Info) << "ModelConverter...";
+
+	Options options;
+	bool profileSteps = false;
+	bool checkNative = false;
+	bool testNative = false;
+	bool stats = false;
+	bool batch = false;
+	bool watch = false;
+	std::string benchmarkDirectory;
+	std::string daemonSocket;
+	std::string clientSocket;
+	std::vector<std::string> files;
+	std::vector<std::string> args(argv, argv + argc);
+	std::vector<std::string> childCommand(1, argv[0]); // the options for the conversions of a scheduled batch
+	std::vector<std::string> daemonArgs; // the options a daemon accepts, the others only change this process
+	for (size_t i = 1; i < args.size(); i++)
+	{
+		std::string arg = args[i];
+		size_t first = i;
+		bool forward = true;
+		std::string error;
+		if (conversionOption(args, i, options, error))
+		{
+			if (!error.empty())
+			{
+				LOG(Error) << error;
+				return -1;
+			}
+			daemonArgs.insert(daemonArgs.end(), args.begin() + first, args.begin() + i + 1);
+		}
+		else if (arg == "--profile-steps")
+			profileSteps = true;
+		else if (arg == "--check-native-steps")
+			checkNative = true;
+		else if (arg == "--test-native-steps")
+			testNative = true;
+		else if (arg == "--stats")
+			stats = true;
+		else if (arg == "--log-level" && i + 1 < args.size())
+		{
+			if (!logger.setLevel(args[++i]))
+			{
+				LOG(Error) << "Unknown log level " << args[i] << ", use error, warning, info or debug";
+				return -1;
+			}
+		}
+		else if (arg == "--log-rate" && i + 1 < args.size())
+			logger.setRateLimit(atoi(args[++i].c_str()));
+		else if (arg == "--log-json")
+			logger.setJson(true);
+		else if (arg == "--batch")
+		{
+			batch = true;
+			forward = false;
+		}
+		else if (arg == "--watch")
+		{
+			watch = true;
+			forward = false;
+		}
+		else if (arg == "--prefetch" && i + 1 < args.size())
+			options.prefetch = atoi(args[++i].c_str());
+		else if (arg == "--jobs" && i + 1 < args.size())
+		{
+			options.jobs = atoi(args[++i].c_str());
+			forward = false;
+		}
+		else if (arg == "--memory-budget" && i + 1 < args.size())
+		{
+			options.memoryBudget = atoi(args[++i].c_str());
+			forward = false;
+		}
+		else if (arg == "--trace" && i + 1 < args.size())
+		{
+			trace.open(args[++i]);
+			forward = false;
+		}
+		else if (arg == "--memory-stats")
+		{
+			enableMemoryStats(0);
+			forward = false;
+		}
+		else if (arg == "--alloc-budget" && i + 1 < args.size())
+		{
+			enableMemoryStats(atoi(args[++i].c_str()) * 1024LL * 1024LL);
+			forward = false;
+		}
+		else if (arg == "--progress" && i + 1 < args.size())
+		{
+			if (!progress.open(args[++i]))
+			{
+				LOG(Error) << "Could not open " << args[i] << " for progress output";
+				return -1;
+			}
+		}
+		else if (arg == "--isolate")
+		{
+			options.isolate = true;
+			forward = false;
+		}
+		else if (arg == "--job-timeout" && i + 1 < args.size())
+		{
+			options.jobTimeout = atoi(args[++i].c_str());
+			forward = false;
+		}
+		else if (arg == "--job-memory" && i + 1 < args.size())
+		{
+			options.jobMemory = atoi(args[++i].c_str());
+			forward = false;
+		}
+		else if (arg == "--memory-history" && i + 1 < args.size())
+		{
+			options.memoryHistory = args[++i];
+			forward = false;
+		}
+		else if (arg == "--benchmark" && i + 1 < args.size())
+		{
+			benchmarkDirectory = args[++i];
+			forward = false;
+		}
+		else if (arg == "--benchmark-repeats" && i + 1 < args.size())
+			options.benchmarkRepeats = atoi(args[++i].c_str());
+		else if (arg == "--baseline" && i + 1 < args.size())
+			options.baseline = args[++i];
+		else if (arg == "--save-baseline" && i + 1 < args.size())
+			options.saveBaseline = args[++i];
+		else if (arg == "--regression-threshold" && i + 1 < args.size())
+			options.regressionThreshold = (float)atof(args[++i].c_str());
+		else if (arg == "--daemon" && i + 1 < args.size())
+		{
+			daemonSocket = args[++i];
+			forward = false;
+		}
+		else if (arg == "--client" && i + 1 < args.size())
+		{
+			clientSocket = args[++i];
+			forward = false;
+		}
+		else
+		{
+			files.push_back(arg);
+			forward = false;
+		}
+		for (size_t ii = first; forward && ii <= i; ii++)
+			childCommand.push_back(args[ii]);
+	}
 
+	if (!daemonSocket.empty())
+		return runDaemon(daemonSocket, options);
+	if (!benchmarkDirectory.empty())
+		return runBenchmark(benchmarkDirectory, options);
+	if (testNative)
+		return testNativeSteps(options) ? 0 : -1;
 
+	if (files.empty())
+	{
+		printf("Please add a model filename as 2nd parameter\n");
+		printf("Options:\n");
+		printf("  --resample <fps>   resample animations at a fixed rate into per-frame tracks\n");
+		printf("  --reduce <error>   remove animation keys that can be interpolated within this world space error\n");
+		printf("  --reduce-position <error>, --reduce-rotation <error>, --reduce-scale <error>\n");
+		printf("                     set the allowed error for one kind of key\n");
+		printf("  --binary-anim      write animations as compact binary .anim files\n");
+		printf("  --threads <count>  number of threads used for exporting, defaults to one per core\n");
+		printf("  --cache <dir>      reuse earlier results for models that did not change, stored in dir\n");
+		printf("  --cache-size <mb>  size limit of the cache, the least recently used results are removed first (default 1024)\n");
+		printf("  --cache-link       hard link results from the cache instead of copying them\n");
+		printf("  --scene-cache <dir> keep imported scenes in dir, so changing only output options skips the import\n");
+		printf("  --profile <name>   post processing done on imported models, one of\n");
+		printImportProfiles();
+		printf("  --profile-steps    time every post processing step of the profile and show how it changes the model, without converting\n");
+		printf("  --native-steps     calculate normals and tangents, join vertices and optimize for the vertex cache on all meshes in parallel,\n");
+		printf("                     instead of with assimp's single threaded steps\n");
+		printf("  --native-obj       read obj files with a multithreaded reader instead of assimp, and post process them with the native steps\n");
+		printf("  --check-native-steps compare the native steps with assimp's on a model, without converting\n");
+		printf("  --test-native-steps compare every native step with assimp's on generated models, no model is needed\n");
+		printf("  --stats            show vertex cache use, duplicate vertices, bone influences, animation keys and output size of every model given,\n");
+		printf("                     without converting\n");
+		printf("  --batch            convert every file given to file.json, reading the next files and writing results while converting\n");
+		printf("  --watch            keep converting the models in the directories given, when they or their mtl files and textures are saved\n");
+		printf("  --prefetch <count> number of files read ahead and waiting to be written in a batch (default 2)\n");
+		printf("  --jobs <count>     convert this many files of a batch at the same time, in separate processes, 0 for one per core\n");
+		printf("  --memory-budget <mb> only start conversions in a batch while their estimated peak memory fits in this budget\n");
+		printf("  --memory-history <file> peak memory of earlier conversions, used for the estimates (default modelconvert-memory.json)\n");
+		printf("  --log-level <level> error, warning, info (default) or debug\n");
+		printf("  --log-rate <count> messages per second that every warning, info or debug log statement can write, the rest are counted (default 10, 0 for all)\n");
+		printf("  --log-json         write log messages as json lines with their time, level and thread\n");
+		printf("  --trace <file>     write how long every stage of the conversion took as a chrome trace, on exit\n");
+		printf("  --memory-stats     count the allocations of every stage, and show them in a table on exit\n");
+		printf("  --alloc-budget <mb> like --memory-stats, and fail when the heap grows over this\n");
+		printf("  --progress <file>  append the progress of every conversion to file as json lines, - for stderr\n");
+		printf("  --deadline <s>     cancel conversions that take longer than this\n");
+		printf("  --isolate          convert every file of a batch in a worker forked from this process, so a crash only fails that file\n");
+		printf("  --job-timeout <s>  stop isolated conversions that take longer than this\n");
+		printf("  --job-memory <mb>  limit the memory of isolated conversions\n");
+		printf("  --benchmark <dir>  write generated models of a few sizes to dir, and time converting them\n");
+		printf("  --benchmark-repeats <count> runs of every benchmark conversion, the median is used (default 5)\n");
+		printf("  --save-baseline <file> keep the benchmark results in file\n");
+		printf("  --baseline <file>  fail the benchmark when a stage got slower than in this baseline\n");
+		printf("  --regression-threshold <percent> how much slower a stage can get before it fails (default 10)\n");
+		printf("  --daemon <socket>  keep running and convert the models that clients send to the unix socket, with --jobs workers\n");
+		printf("  --client <socket>  have the daemon on the socket convert the model, with the options given here\n");
+		getchar();
+		return -1;
+	}
+
+	char buf[1024];
+	_getcwd(buf, 1024);
+	LOG(Debug) << "Current working dir: " << buf;
+
+	if (stats)
+	{
+		int result = 0;
+		for (size_t i = 0; i < files.size(); i++)
+			if (!printModelStats(files[i], options))
+				result = -1;
+		return result;
+	}
+	if (watch)
+		return watchDirectories(childCommand, files, options);
+	if (batch)
+	{
+#ifdef _WIN32
+		for (size_t i = 0; i < files.size(); i++)
+			std::replace(files[i].begin(), files[i].end(), '/', '\\');
+#endif
+		if (options.isolate)
+			return isolatedBatch(childCommand, files, options);
+		if (options.jobs != 1 || options.memoryBudget > 0)
+			return scheduleBatch(childCommand, files, options);
+		return convertBatch(files, options);
+	}
+
+	std::string filename = files[0];
+#ifdef _WIN32
+	std::replace(filename.begin(), filename.end(), '/', '\\');
+#endif
+	LOG(Info) << "Extension found: " << fileExtension(filename);
+
+	if (profileSteps)
+		return profileImportSteps(filename, options) ? 0 : -1;
+	if (checkNative)
+		return checkNativeSteps(filename, options) ? 0 : -1;
 
+	std::string outfile = filename + ".json";
+	if (files.size() > 1)
+		outfile = files[1];
+
+	if (!clientSocket.empty())
+		return sendToDaemon(clientSocket, files[0], files.size() > 1 ? files[1] : "", daemonArgs);
+
+	ConversionCache* cache = NULL;
+	std::string cacheKey;
+	if (!options.cacheDirectory.empty() && outfile != "-")
+	{
+		cache = new ConversionCache(options.cacheDirectory, options.cacheSize * 1024LL * 1024LL, options.cacheLinks);
+		cacheKey = cache->key(filename, options);
+		if (cache->restore(cacheKey, filename, outfile))
+		{
+			delete cache;
+			return 0;
+		}
+	}
+
+	std::vector<std::string> outputFiles;
+	blib::json::Value data = convertModel(filename, options, outputFiles);
 
 	if (outfile == "-")
 		std::cout << data;
-	else if (data.isNull())
-		return 0;
-	else
+	else if (!data.isNull())
+	{
+		writeModel(data, outfile);
+		outputFiles.push_back(outfile);
+	}
+
+	if (cache)
 	{
-		//std::ofstream(outfile) << data;
-		std::ofstream out(outfile);
-		data.prettyPrint(out, wrapConfig);
+		if (!outputFiles.empty())
+			cache->store(cacheKey, filename, outfile, outputFiles);
+		delete cache;
 	}
 
+	//animated models are written by their converter, which returns null
+	if (data.isNull() && outputFiles.empty())
+		return -1;
 	return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[])
+{
+	int result = run(argc, argv);
+	logger.stop();
+	if (!printMemoryStats())
+		return -2;
+	return result;
+}
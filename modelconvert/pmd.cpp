@@ -1,8 +1,19 @@
 #include <string>
+#include <vector>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 #include <blib/json.h>
 #include <string.h>
+#include <stdint.h>
+#include <assimp/types.h>
+
+#include "ModelConvert.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "Logger.h"
+
+blib::json::Value matrixAsJson(const aiMatrix4x4& matrix);
 
 #pragma pack(push)
 #pragma pack(1)
@@ -49,51 +60,193 @@ struct Material
 		ambientB;
 	char toonNumber,
 		edgeFlag;
-	unsigned long vertexCount;
+	uint32_t vertexCount;
 	char texture[20];
 
 };
 
+struct Bone
+{
+	char name[20];
+	unsigned short parent;		// 0xFFFF for bones at the root
+	unsigned short tail;
+	char type;
+	unsigned short ikParent;
+	float headx,				// in model space
+		heady,
+		headz;
+};
+
+struct IkHeader
+{
+	unsigned short bone;		// the bone that is moved to the target
+	unsigned short target;		// the end of the chain, that should end up at bone
+	unsigned char chainLength;
+	unsigned short iterations;
+	float limit;				// maximum rotation per iteration
+	// followed by chainLength bone ids, from the target up
+};
+
+struct SkinHeader
+{
+	char name[20];
+	uint32_t vertexCount;
+	char type;					// 0 is the base skin, the others are brow, eye, lip and other
+	// followed by vertexCount SkinVertex
+};
+
+struct SkinVertex
+{
+	uint32_t index;				// a vertex of the model in the base skin, an entry of the base skin in the others
+	float x,					// the position in the base skin, the offset from it in the others
+		y,
+		z;
+};
+
 #pragma pack(pop)
 
+//names are shift-jis, padded with zeroes
+static std::string pmdName(const char* name)
+{
+	return std::string(name, strnlen(name, 20));
+}
+
+//pmd bones only have a head position in model space, so the bind pose is a translation from the parent, and the offset
+//the inverse of the head position. The root is a node of its own, so the skeleton has a single root like assimp's
+static blib::json::Value buildPmdSkeleton(const std::vector<Bone> &bones, int parent, int &index)
+{
+	blib::json::Value node;
+	aiMatrix4x4 matrix;
+	if (parent == -1)
+		node["name"] = "root";
+	else
+	{
+		const Bone &bone = bones[parent];
+		aiVector3D head(bone.headx, bone.heady, bone.headz);
+		if (bone.parent < bones.size())
+			head -= aiVector3D(bones[bone.parent].headx, bones[bone.parent].heady, bones[bone.parent].headz);
+		node["name"] = pmdName(bone.name);
+		aiMatrix4x4::Translation(head, matrix);
+		aiMatrix4x4 offset;
+		node["offset"] = matrixAsJson(aiMatrix4x4::Translation(aiVector3D(-bone.headx, -bone.heady, -bone.headz), offset));
+		node["id"] = parent;
+	}
+	node["index"] = index++;
+	node["matrix"] = matrixAsJson(matrix);
+	for (size_t i = 0; i < bones.size(); i++)
+	{
+		//bones with a parent that does not exist are put at the root instead of being dropped
+		bool isChild = parent == -1 ? bones[i].parent >= bones.size() : bones[i].parent == parent;
+		if (isChild && (int)i != parent)
+			node["children"].push_back(buildPmdSkeleton(bones, (int)i, index));
+	}
+	return node;
+}
+
+//adds the ik chain to the node of the bone it moves
+static void addIk(blib::json::Value &node, const IkHeader &ik, const std::vector<unsigned short> &chain)
+{
+	if (node.isMember("id") && node["id"].asInt() == ik.bone)
+	{
+		blib::json::Value data;
+		data["target"] = ik.target;
+		data["iterations"] = ik.iterations;
+		data["limit"] = ik.limit;
+		data["chain"] = blib::json::Value(blib::json::Type::arrayValue);
+		for (size_t i = 0; i < chain.size(); i++)
+			data["chain"].push_back(chain[i]);
+		node["ik"].push_back(data);
+	}
+	else if (node.isMember("children"))
+	{
+		for (size_t i = 0; i < node["children"].size(); i++)
+			addIk(node["children"][(int)i], ik, chain);
+	}
+}
 
 
-blib::json::Value convertPmd(std::string filename)
+blib::json::Value convertPmd(std::string filename, blib::json::Value &skeleton)
 {
+	TRACE_SCOPE("convert pmd");
 	std::ifstream file(filename.c_str(), std::ios_base::binary | std::ios_base::in);
 	if (!file.is_open())
 	{
-		printf("Could not open file\n ");
+		LOG(Error) << "Could not open " << filename;
 		return blib::json::Value();
 	}
 	Header header;
 	file.read((char*)&header, sizeof(Header));
 	
-	unsigned long vertexCount;
+	uint32_t vertexCount = 0;
 	file.read((char*)&vertexCount, 4);
-	printf("%i vertices found\n", vertexCount);
+	LOG(Info) << vertexCount << " vertices found";
 	Vertex* vertices = new Vertex[vertexCount];
 	file.read((char*)vertices, vertexCount * sizeof(Vertex));
 
-	unsigned long indexCount;
+	uint32_t indexCount = 0;
 	file.read((char*)&indexCount, 4);
-	printf("%i indices found (should be divisable by 3)\n", indexCount);
+	LOG(Info) << indexCount << " indices found (should be divisible by 3)";
 	
 	unsigned short* indices = new unsigned short[indexCount];
 	file.read((char*)indices, indexCount * sizeof(unsigned short));
 
-	unsigned long materialCount;
+	uint32_t materialCount = 0;
 	file.read((char*)&materialCount, 4);
-	printf("%i materials\n", materialCount);
+	LOG(Info) << materialCount << " materials";
 
 	Material* materials = new Material[materialCount];
 	memset(materials, 0, materialCount * sizeof(Material));
 	file.read((char*)materials, materialCount * sizeof(Material));
 
+	//the sections after the materials, the files the benchmark writes end with them empty. Counts that can't be read are 0
+	unsigned short boneCount = 0;
+	file.read((char*)&boneCount, 2);
+	std::vector<Bone> bones(file ? boneCount : 0);
+	if (!bones.empty())
+		file.read((char*)&bones[0], bones.size() * sizeof(Bone));
+	LOG(Info) << bones.size() << " bones";
+
+	unsigned short ikCount = 0;
+	file.read((char*)&ikCount, 2);
+	std::vector<IkHeader> iks;
+	std::vector<std::vector<unsigned short> > ikChains;
+	for (int i = 0; i < ikCount && file; i++)
+	{
+		IkHeader ik;
+		file.read((char*)&ik, sizeof(IkHeader));
+		std::vector<unsigned short> chain(ik.chainLength);
+		if (!chain.empty())
+			file.read((char*)&chain[0], chain.size() * sizeof(unsigned short));
+		if (!file)
+			break;
+		iks.push_back(ik);
+		ikChains.push_back(chain);
+	}
+
+	unsigned short skinCount = 0;
+	file.read((char*)&skinCount, 2);
+	std::vector<SkinHeader> skins;
+	std::vector<std::vector<SkinVertex> > skinVertices;
+	for (int i = 0; i < skinCount && file; i++)
+	{
+		SkinHeader skin;
+		file.read((char*)&skin, sizeof(SkinHeader));
+		if (!file || skin.vertexCount > vertexCount)
+			break;
+		std::vector<SkinVertex> skinVertex(skin.vertexCount);
+		if (!skinVertex.empty())
+			file.read((char*)&skinVertex[0], skinVertex.size() * sizeof(SkinVertex));
+		if (!file)
+			break;
+		skins.push_back(skin);
+		skinVertices.push_back(skinVertex);
+	}
+	LOG(Info) << iks.size() << " ik chains, " << skins.size() << " skins";
 
 	file.close();
 
 
+	TRACE_SCOPE("build json");
 	blib::json::Value model(blib::json::Type::objectValue);
 	model["name"] = "converted from " + filename;
 	model["version"] = 1;
@@ -103,9 +256,19 @@ blib::json::Value convertPmd(std::string filename)
 	model["format"].push_back(2);
 	model["format"].push_back("normal");
 	model["format"].push_back(3);
+	bool skinned = !bones.empty(); // models without bones have no use for the bone attributes
+	if (skinned)
+	{
+		model["format"].push_back("boneIDs");
+		model["format"].push_back(4);
+		model["format"].push_back("weights");
+		model["format"].push_back(4);
+	}
 
 	for (size_t i = 0; i < vertexCount; i++)
 	{
+		if (i % 4096 == 0 && !progress.update("vertices", i / (float)vertexCount))
+			break;
 		model["vertices"].push_back(vertices[i].posx);
 		model["vertices"].push_back(vertices[i].posy);
 		model["vertices"].push_back(vertices[i].posz);
@@ -116,12 +279,45 @@ blib::json::Value convertPmd(std::string filename)
 		model["vertices"].push_back(vertices[i].normalx);
 		model["vertices"].push_back(vertices[i].normaly);
 		model["vertices"].push_back(vertices[i].normalz);
+
+		if (!skinned)
+			continue;
+		//two bones per vertex, the weight of the first in percent. Bones that don't exist are dropped and the weights
+		//of the others scaled up to 1, a vertex without any bone left follows the first bone
+		unsigned short boneIds[2] = { vertices[i].boneId0, vertices[i].boneId1 };
+		float weight = std::min(100, std::max(0, (int)vertices[i].weight)) / 100.0f;
+		float weights[2] = { weight, 1 - weight };
+		float total = 0;
+		for (int ii = 0; ii < 2; ii++)
+		{
+			if (boneIds[ii] >= bones.size())
+			{
+				boneIds[ii] = 0;
+				weights[ii] = 0;
+			}
+			total += weights[ii];
+		}
+		if (total > 0)
+		{
+			weights[0] /= total;
+			weights[1] /= total;
+		}
+		else
+			weights[0] = 1;
+		for (int ii = 0; ii < 2; ii++)
+			model["vertices"].push_back(boneIds[ii]);
+		model["vertices"].push_back(0);
+		model["vertices"].push_back(0);
+		for (int ii = 0; ii < 2; ii++)
+			model["vertices"].push_back(weights[ii]);
+		model["vertices"].push_back(0.0f);
+		model["vertices"].push_back(0.0f);
 	}
 
 
 	int index = 0;
 
-	for (size_t i = 0; i < materialCount; i++)
+	for (size_t i = 0; i < materialCount && !progress.isCancelled(); i++)
 	{
 		blib::json::Value mesh;
 		mesh["material"]["ambient"].push_back(materials[i].ambientR);
@@ -152,10 +348,55 @@ blib::json::Value convertPmd(std::string filename)
 		model["meshes"].push_back(mesh);
 	}
 
+	if (!bones.empty())
+	{
+		TRACE_SCOPE("build skeleton");
+		int nodeIndex = 0;
+		skeleton = buildPmdSkeleton(bones, -1, nodeIndex);
+		for (size_t i = 0; i < iks.size(); i++)
+			addIk(skeleton, iks[i], ikChains[i]);
+	}
+
+	//the base skin has the model vertices the other skins change, the others are offsets for entries of the base skin.
+	//Morphs are written as the model vertices they move and the offsets, so the runtime only touches those
+	const std::vector<SkinVertex>* base = NULL;
+	for (size_t i = 0; i < skins.size(); i++)
+		if (skins[i].type == 0)
+			base = &skinVertices[i];
+	for (size_t i = 0; i < skins.size() && base; i++)
+	{
+		if (skins[i].type == 0)
+			continue;
+		std::vector<std::pair<uint32_t, const SkinVertex*> > changed;
+		for (size_t ii = 0; ii < skinVertices[i].size(); ii++)
+		{
+			const SkinVertex &vertex = skinVertices[i][ii];
+			if (vertex.index < base->size() && (*base)[vertex.index].index < vertexCount)
+				changed.push_back(std::make_pair((*base)[vertex.index].index, &vertex));
+		}
+		std::sort(changed.begin(), changed.end(), [](const std::pair<uint32_t, const SkinVertex*> &a, const std::pair<uint32_t, const SkinVertex*> &b) { return a.first < b.first; });
+
+		blib::json::Value morph;
+		morph["name"] = pmdName(skins[i].name);
+		morph["category"] = (int)skins[i].type;
+		morph["vertices"] = blib::json::Value(blib::json::Type::arrayValue);
+		morph["offsets"] = blib::json::Value(blib::json::Type::arrayValue);
+		for (size_t ii = 0; ii < changed.size(); ii++)
+		{
+			morph["vertices"].push_back((int)changed[ii].first);
+			morph["offsets"].push_back(changed[ii].second->x);
+			morph["offsets"].push_back(changed[ii].second->y);
+			morph["offsets"].push_back(changed[ii].second->z);
+		}
+		model["morphs"].push_back(morph);
+	}
+
 
 	delete[] vertices;
 	delete[] indices;
+	delete[] materials;
 
-
+	if (!progress.update("meshes", 1))
+		return blib::json::Value();
 	return model;
 }
\ No newline at end of file
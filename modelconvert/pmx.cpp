@@ -0,0 +1,411 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <blib/json.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "ModelConvert.h"
+#include "MappedFile.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "Logger.h"
+
+// PMX, the successor of pmd. Sections are variable length, with strings in UTF-16 or UTF-8 and indices of 1, 2 or 4
+// bytes, as set in the header. The file is mapped and walked in place; the vertex and face loops are templates on the
+// index types, so the width is decided once per section instead of once per index. Only the sections up to the
+// materials are read, the bones, morphs and physics after them are not converted
+
+struct PmxGlobals
+{
+	unsigned char encoding;		// 0 is UTF-16LE, 1 is UTF-8
+	unsigned char additionalVec4Count;
+	unsigned char vertexIndexSize;
+	unsigned char textureIndexSize;
+	unsigned char materialIndexSize;
+	unsigned char boneIndexSize;
+	unsigned char morphIndexSize;
+	unsigned char rigidBodyIndexSize;
+};
+
+enum PmxWeightType
+{
+	BDEF1 = 0,
+	BDEF2 = 1,
+	BDEF4 = 2,
+	SDEF = 3,
+	QDEF = 4,	// pmx 2.1
+};
+
+// reads values straight from the mapped file. Reading past the end sets failed and returns zeroes, so a broken file
+// is noticed once after a section instead of at every read
+class PmxReader
+{
+	const char* p;
+	const char* end;
+public:
+	bool failed;
+
+	PmxReader(const char* data, size_t size) : p(data), end(data + size), failed(false) {}
+
+	bool has(size_t bytes)
+	{
+		if ((size_t)(end - p) < bytes)
+			failed = true;
+		return !failed;
+	}
+
+	//checked before allocating for a count read from the file, so a broken count can't ask for more memory than the
+	//file could hold. Divides instead of multiplying, count * size can overflow
+	bool hasItems(size_t count, size_t size)
+	{
+		if (count > (size_t)(end - p) / size)
+			failed = true;
+		return !failed;
+	}
+
+	template<class T>
+	T read()
+	{
+		T value;
+		if (!has(sizeof(T)))
+			return T();
+		memcpy(&value, p, sizeof(T)); // the file has no alignment
+		p += sizeof(T);
+		return value;
+	}
+
+	void skip(size_t bytes)
+	{
+		if (has(bytes))
+			p += bytes;
+	}
+
+	//counts are signed in pmx, a negative one is a broken file
+	size_t readCount()
+	{
+		int count = read<int>();
+		if (count < 0)
+			failed = true;
+		return failed ? 0 : (size_t)count;
+	}
+
+	const char* take(size_t bytes)
+	{
+		if (!has(bytes))
+			return NULL;
+		const char* ret = p;
+		p += bytes;
+		return ret;
+	}
+};
+
+static void appendUtf8(std::string &out, unsigned int c)
+{
+	if (c < 0x80)
+		out += (char)c;
+	else if (c < 0x800)
+	{
+		out += (char)(0xc0 | (c >> 6));
+		out += (char)(0x80 | (c & 0x3f));
+	}
+	else if (c < 0x10000)
+	{
+		out += (char)(0xe0 | (c >> 12));
+		out += (char)(0x80 | ((c >> 6) & 0x3f));
+		out += (char)(0x80 | (c & 0x3f));
+	}
+	else
+	{
+		out += (char)(0xf0 | (c >> 18));
+		out += (char)(0x80 | ((c >> 12) & 0x3f));
+		out += (char)(0x80 | ((c >> 6) & 0x3f));
+		out += (char)(0x80 | (c & 0x3f));
+	}
+}
+
+//texts are a byte length and the characters, returned as UTF-8 for the json output
+static std::string readText(PmxReader &in, const PmxGlobals &globals)
+{
+	size_t length = in.readCount();
+	const char* data = in.take(length);
+	if (!data)
+		return "";
+	if (globals.encoding == 1)
+		return std::string(data, length);
+
+	std::string ret;
+	const unsigned char* chars = (const unsigned char*)data;
+	for (size_t i = 0; i + 1 < length; i += 2)
+	{
+		unsigned int c = chars[i] | (chars[i + 1] << 8);
+		if (c >= 0xd800 && c < 0xdc00 && i + 3 < length)
+		{
+			unsigned int low = chars[i + 2] | (chars[i + 3] << 8);
+			if (low >= 0xdc00 && low < 0xe000)
+			{
+				c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+				i += 2;
+			}
+		}
+		appendUtf8(ret, c);
+	}
+	return ret;
+}
+
+//vertex indices are unsigned for 1 and 2 bytes, and signed for 4. All other indices are signed, with -1 for none
+template<class T> struct PmxIndex { static int get(T value) { return value; } };
+template<> struct PmxIndex<unsigned int> { static int get(unsigned int value) { return (int)value; } };
+
+template<class T>
+static int readIndex(PmxReader &in)
+{
+	return PmxIndex<T>::get(in.read<T>());
+}
+
+//returns the index of the size in the header as one of the types for it, so callers can dispatch on it once
+static int indexType(unsigned char size)
+{
+	return size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : -1;
+}
+
+template<class BoneIndex>
+static void readVertices(PmxReader &in, const PmxGlobals &globals, size_t count, blib::json::Value &vertices)
+{
+	TRACE_SCOPE("read pmx vertices");
+	for (size_t i = 0; i < count && !in.failed; i++)
+	{
+		if (i % 4096 == 0 && !progress.update("vertices", i / (float)count))
+			return;
+		float v[8];
+		for (int ii = 0; ii < 8; ii++)
+			v[ii] = in.read<float>();
+		in.skip(16 * globals.additionalVec4Count);
+
+		int bones[4] = { 0, 0, 0, 0 };
+		float weights[4] = { 0, 0, 0, 0 };
+		unsigned char type = in.read<unsigned char>();
+		switch (type)
+		{
+		case BDEF1:
+			bones[0] = readIndex<BoneIndex>(in);
+			weights[0] = 1;
+			break;
+		case BDEF2:
+		case SDEF:
+			bones[0] = readIndex<BoneIndex>(in);
+			bones[1] = readIndex<BoneIndex>(in);
+			weights[0] = in.read<float>();
+			weights[1] = 1 - weights[0];
+			if (type == SDEF)
+				in.skip(3 * 12); // the spherical deform center and radii, the runtime skins it as BDEF2
+			break;
+		case BDEF4:
+		case QDEF:
+			for (int ii = 0; ii < 4; ii++)
+				bones[ii] = readIndex<BoneIndex>(in);
+			for (int ii = 0; ii < 4; ii++)
+				weights[ii] = in.read<float>();
+			break;
+		default:
+			in.failed = true;
+			return;
+		}
+		in.skip(4); // edge scale
+
+		//position, texcoord, normal, like the other converters write them
+		vertices.push_back(v[0]);
+		vertices.push_back(v[1]);
+		vertices.push_back(v[2]);
+		vertices.push_back(v[6]);
+		vertices.push_back(v[7]);
+		vertices.push_back(v[3]);
+		vertices.push_back(v[4]);
+		vertices.push_back(v[5]);
+		for (int ii = 0; ii < 4; ii++)
+			vertices.push_back(bones[ii] < 0 ? 0 : bones[ii]);
+		for (int ii = 0; ii < 4; ii++)
+			vertices.push_back(bones[ii] < 0 ? 0.0f : weights[ii]);
+	}
+}
+
+template<class VertexIndex>
+static void readFaces(PmxReader &in, size_t count, size_t vertexCount, std::vector<int> &indices)
+{
+	TRACE_SCOPE("read pmx faces");
+	if (!in.hasItems(count, sizeof(VertexIndex)))
+		return;
+	indices.resize(count);
+	for (size_t i = 0; i < count && !in.failed; i++)
+	{
+		indices[i] = readIndex<VertexIndex>(in);
+		if (indices[i] < 0 || (size_t)indices[i] >= vertexCount)
+			in.failed = true;
+	}
+}
+
+static int readIndexOfSize(PmxReader &in, unsigned char size)
+{
+	switch (indexType(size))
+	{
+	case 0: return readIndex<signed char>(in);
+	case 1: return readIndex<short>(in);
+	default: return readIndex<int>(in);
+	}
+}
+
+
+blib::json::Value convertPmx(const std::string &filename)
+{
+	TRACE_SCOPE("convert pmx");
+	MappedFile file;
+	file.open(filename);
+	if (!file.data)
+	{
+		LOG(Error) << "Could not open " << filename;
+		return blib::json::Value();
+	}
+	PmxReader in(file.data, file.size);
+
+	const char* magic = in.take(4);
+	float version = in.read<float>();
+	if (!magic || memcmp(magic, "PMX ", 4) != 0)
+	{
+		LOG(Error) << filename << " is not a pmx file";
+		return blib::json::Value();
+	}
+	unsigned char globalCount = in.read<unsigned char>();
+	PmxGlobals globals;
+	memset(&globals, 0, sizeof(globals));
+	const char* globalData = in.take(globalCount);
+	if (globalData)
+		memcpy(&globals, globalData, std::min((size_t)globalCount, sizeof(globals)));
+	if (in.failed || globals.encoding > 1 || globals.additionalVec4Count > 4 || globals.vertexIndexSize == 0 ||
+		indexType(globals.vertexIndexSize) < 0 || indexType(globals.textureIndexSize) < 0 || indexType(globals.boneIndexSize) < 0)
+	{
+		LOG(Error) << filename << " has an unsupported pmx header";
+		return blib::json::Value();
+	}
+	LOG(Info) << "pmx version " << version;
+
+	readText(in, globals);	// name
+	readText(in, globals);	// english name
+	readText(in, globals);	// comment
+	readText(in, globals);	// english comment
+
+	blib::json::Value model(blib::json::Type::objectValue);
+	model["name"] = "converted from " + filename;
+	model["version"] = 1;
+	model["format"].push_back("position");
+	model["format"].push_back(3);
+	model["format"].push_back("texcoord");
+	model["format"].push_back(2);
+	model["format"].push_back("normal");
+	model["format"].push_back(3);
+	model["format"].push_back("boneIDs");
+	model["format"].push_back(4);
+	model["format"].push_back("weights");
+	model["format"].push_back(4);
+	model["vertices"] = blib::json::Value(blib::json::Type::arrayValue);
+	model["meshes"] = blib::json::Value(blib::json::Type::arrayValue);
+
+	size_t vertexCount = in.readCount();
+	LOG(Info) << vertexCount << " vertices found";
+	in.hasItems(vertexCount, 8 * 4 + 1 + 4); // position, normal, texcoord, weight type and edge scale, the smallest a vertex can be
+	switch (indexType(globals.boneIndexSize))
+	{
+	case 0: readVertices<signed char>(in, globals, vertexCount, model["vertices"]); break;
+	case 1: readVertices<short>(in, globals, vertexCount, model["vertices"]); break;
+	default: readVertices<int>(in, globals, vertexCount, model["vertices"]); break;
+	}
+
+	if (progress.isCancelled())
+		return blib::json::Value();
+
+	size_t indexCount = in.readCount();
+	LOG(Info) << indexCount << " indices found (should be divisible by 3)";
+	std::vector<int> indices;
+	switch (indexType(globals.vertexIndexSize))
+	{
+	case 0: readFaces<unsigned char>(in, indexCount, vertexCount, indices); break;
+	case 1: readFaces<unsigned short>(in, indexCount, vertexCount, indices); break;
+	default: readFaces<int>(in, indexCount, vertexCount, indices); break;
+	}
+
+	size_t textureCount = in.readCount();
+	std::vector<std::string> textures;
+	if (in.hasItems(textureCount, 4)) // every texture name has at least its length
+		textures.resize(textureCount);
+	for (size_t i = 0; i < textures.size() && !in.failed; i++)
+		textures[i] = readText(in, globals);
+
+	size_t materialCount = in.readCount();
+	LOG(Info) << materialCount << " materials";
+	size_t index = 0;
+	for (size_t i = 0; i < materialCount && !in.failed; i++)
+	{
+		if (!progress.update("meshes", i / (float)materialCount))
+			return blib::json::Value();
+		readText(in, globals);	// name
+		readText(in, globals);	// english name
+		float diffuse[4], specular[3], ambient[3];
+		for (int ii = 0; ii < 4; ii++)
+			diffuse[ii] = in.read<float>();
+		for (int ii = 0; ii < 3; ii++)
+			specular[ii] = in.read<float>();
+		float shinyness = in.read<float>();
+		for (int ii = 0; ii < 3; ii++)
+			ambient[ii] = in.read<float>();
+		in.skip(1 + 16 + 4);	// drawing flags, edge color and edge size
+		int texture = readIndexOfSize(in, globals.textureIndexSize);
+		readIndexOfSize(in, globals.textureIndexSize);	// sphere map
+		in.skip(1);	// sphere map mode
+		if (in.read<unsigned char>() == 0)
+			readIndexOfSize(in, globals.textureIndexSize);	// toon texture
+		else
+			in.skip(1);	// one of the shared toon textures
+		readText(in, globals);	// memo
+		size_t faceCount = in.readCount();
+		if (in.failed || index + faceCount > indices.size())
+		{
+			in.failed = true;
+			break;
+		}
+
+		blib::json::Value mesh;
+		mesh["material"]["ambient"].push_back(ambient[0]);
+		mesh["material"]["ambient"].push_back(ambient[1]);
+		mesh["material"]["ambient"].push_back(ambient[2]);
+
+		mesh["material"]["diffuse"].push_back(diffuse[0]);
+		mesh["material"]["diffuse"].push_back(diffuse[1]);
+		mesh["material"]["diffuse"].push_back(diffuse[2]);
+
+		mesh["material"]["shinyness"] = shinyness;
+
+		mesh["material"]["specular"].push_back(specular[0]);
+		mesh["material"]["specular"].push_back(specular[1]);
+		mesh["material"]["specular"].push_back(specular[2]);
+
+		mesh["material"]["alpha"] = diffuse[3];
+
+		if (texture >= 0 && (size_t)texture < textures.size())
+			mesh["material"]["texture"] = textures[texture];
+		else
+			mesh["material"]["texture"] = "../textures/whitepixel.png";
+
+		mesh["faces"] = blib::json::Value(blib::json::Type::arrayValue);
+		for (size_t ii = index; ii < index + faceCount; ii++)
+			mesh["faces"].push_back(indices[ii]);
+		index += faceCount;
+		model["meshes"].push_back(mesh);
+	}
+
+	if (in.failed)
+	{
+		LOG(Error) << filename << " is broken or truncated";
+		return blib::json::Value();
+	}
+	return model;
+}